@@ -0,0 +1,423 @@
+#include "analysis.hpp"
+#include "expr.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <memory>
+#include <optional>
+
+namespace puzzle {
+
+static std::string toString(__int128 value)
+{
+	if (value < 0)
+		return '-' + toString(-value);
+	std::string digits;
+	do {
+		digits += static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value);
+	return std::string(digits.rbegin(), digits.rend());
+}
+
+static __int128 gcd(__int128 a, __int128 b)
+{
+	a = a < 0 ? -a : a;
+	b = b < 0 ? -b : b;
+	while (b) {
+		__int128 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static __int128 floorDiv(__int128 a, __int128 b)
+{
+	__int128 q = a / b;
+	return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static __int128 ceilDiv(__int128 a, __int128 b)
+{
+	__int128 q = a / b;
+	return (a % b != 0 && (a < 0) == (b < 0)) ? q + 1 : q;
+}
+
+Analysis::Analysis(const Puzzle &puzzle, const LinearEvaluator *linear)
+	: radix(puzzle.getRadix()), numLetters(puzzle.getNumLetters()),
+	  leading(puzzle.getLeading()), domains(numLetters * radix, true),
+	  sizes(numLetters, radix)
+{
+	for (int i = 0; i < numLetters; ++i)
+		names += puzzle[i];
+
+	if (numLetters > radix) {
+		fail("there are " + std::to_string(numLetters) + " letters, but only "
+		     + std::to_string(radix) + " digits");
+		return;
+	}
+	int numLeading = 0;
+	for (int i = 0; i < numLetters; ++i)
+		if (leading[i]) {
+			remove(i, 0);
+			++numLeading;
+		}
+	if (numLeading > radix - 1) {
+		fail(std::to_string(numLeading) + " letters can't be zero, but there "
+		     "are only " + std::to_string(radix - 1) + " other digits");
+		return;
+	}
+
+	std::unique_ptr<LinearEvaluator> own;
+	if (!linear) {
+		try {
+			own = std::make_unique<LinearEvaluator>(puzzle);
+		} catch (const Unsupported &) {
+			checkSides(puzzle);
+			return;
+		}
+		linear = own.get();
+	}
+
+	// Every round that changes something removes a digit, so this ends.
+	bool changed;
+	do {
+		changed = false;
+		for (int row = 0; row < linear->getNumRows(); ++row) {
+			changed |= checkRow(row, *linear);
+			if (infeasible)
+				return;
+		}
+		changed |= checkDistinct();
+	} while (changed && !infeasible);
+}
+
+double Analysis::getReduction() const
+{
+	double reduction = 1;
+	for (int i = 0; i < numLetters; ++i)
+		reduction *= sizes[i] / double(leading[i] ? radix - 1 : radix);
+	return reduction;
+}
+
+/// Returns whether the digit was still allowed.
+bool Analysis::remove(int letter, int digit)
+{
+	if (!domains[letter * radix + digit])
+		return false;
+	domains[letter * radix + digit] = false;
+	--sizes[letter];
+	return true;
+}
+
+void Analysis::fail(std::string why)
+{
+	infeasible = true;
+	reason = std::move(why);
+}
+
+/// Returns whether a domain was narrowed.
+bool Analysis::checkRow(int row, const LinearEvaluator &linear)
+{
+	std::vector<__int128> coeff(numLetters);
+	__int128 divisor = 0;
+	for (int i = 0; i < numLetters; ++i) {
+		coeff[i] = linear.getCoeff(row, i);
+		divisor = gcd(divisor, coeff[i]);
+	}
+	__int128 constant = linear.getConstant(row);
+
+	if (divisor == 0 && constant != 0) {
+		fail("the equation reduces to a false constant equation");
+		return false;
+	}
+	if (divisor != 0 && constant % divisor != 0) {
+		fail("the coefficients of an equation have the common divisor "
+		     + toString(divisor) + ", which doesn't divide its constant "
+		     + toString(constant));
+		return false;
+	}
+
+	bool changed = checkResidues(coeff, constant, radix - 1);
+	if (!infeasible)
+		changed |= checkResidues(coeff, constant, radix);
+	if (!infeasible)
+		changed |= checkRange(coeff, constant);
+	return changed;
+}
+
+/**
+ * Solve the row modulo @p modulus for each letter independently, by
+ * computing the residues reachable by the letters before and after it.
+ * Returns whether a domain was narrowed.
+ */
+bool Analysis::checkResidues(const std::vector<__int128> &coeff,
+                             __int128 constant, int modulus)
+{
+	// Beyond that, the quadratic effort isn't worth it.
+	if (modulus < 2 || modulus > 4096)
+		return false;
+
+	auto reduce = [modulus](__int128 value) {
+		return static_cast<int>((value % modulus + modulus) % modulus);
+	};
+	std::vector<int> letters;
+	std::vector<int> residue(numLetters);
+	for (int i = 0; i < numLetters; ++i) {
+		residue[i] = reduce(coeff[i]);
+		if (residue[i])
+			letters.push_back(i);
+	}
+	int target = reduce(-constant);
+
+	using Residues = std::vector<char>;
+	auto step = [&](const Residues &from, int letter) {
+		Residues to(modulus);
+		for (int digit = 0; digit < radix; ++digit) {
+			if (!allows(letter, digit))
+				continue;
+			int shift = static_cast<int>(
+				int64_t(residue[letter]) * digit % modulus);
+			for (int r = 0; r < modulus; ++r)
+				if (from[r])
+					to[(r + shift) % modulus] = true;
+		}
+		return to;
+	};
+
+	// before[k] and after[k] are reachable by the letters before and after
+	// letters[k].
+	size_t n = letters.size();
+	std::vector<Residues> before(n + 1, Residues(modulus));
+	std::vector<Residues> after(n + 1, Residues(modulus));
+	before[0][0] = after[n][0] = true;
+	for (size_t k = 0; k < n; ++k)
+		before[k + 1] = step(before[k], letters[k]);
+	for (size_t k = n; k-- > 0;)
+		after[k] = step(after[k + 1], letters[k]);
+
+	if (!before[n][target]) {
+		fail("an equation has no solution modulo " + std::to_string(modulus));
+		return false;
+	}
+
+	bool changed = false;
+	for (size_t k = 0; k < n; ++k) {
+		Residues others(modulus);
+		for (int a = 0; a < modulus; ++a)
+			if (before[k][a])
+				for (int b = 0; b < modulus; ++b)
+					if (after[k + 1][b])
+						others[(a + b) % modulus] = true;
+
+		int letter = letters[k];
+		for (int digit = 0; digit < radix; ++digit) {
+			int shift = static_cast<int>(
+				int64_t(residue[letter]) * digit % modulus);
+			if (!others[(target - shift + modulus) % modulus])
+				changed |= remove(letter, digit);
+		}
+	}
+	return changed;
+}
+
+/**
+ * Bound constant + Σ coeff·letter by the smallest and largest digit of each
+ * letter, and narrow each letter to what the others leave room for.
+ * Returns whether a domain was narrowed.
+ */
+bool Analysis::checkRange(const std::vector<__int128> &coeff,
+                          __int128 constant)
+{
+	// LinearEvaluator made sure that none of these sums overflow.
+	std::vector<__int128> low(numLetters), high(numLetters);
+	__int128 min = constant, max = constant;
+	for (int i = 0; i < numLetters; ++i) {
+		int first = 0, last = radix - 1;
+		while (first < radix && !allows(i, first))
+			++first;
+		while (last >= 0 && !allows(i, last))
+			--last;
+		low[i] = std::min(coeff[i] * first, coeff[i] * last);
+		high[i] = std::max(coeff[i] * first, coeff[i] * last);
+		min += low[i];
+		max += high[i];
+	}
+
+	if (min > 0 || max < 0) {
+		fail("the two sides of an equation can't be equal, their difference "
+		     "is between " + toString(min) + " and " + toString(max));
+		return false;
+	}
+
+	bool changed = false;
+	for (int i = 0; i < numLetters; ++i) {
+		if (!coeff[i])
+			continue;
+		// coeff·letter has to be in [lower, upper].
+		__int128 lower = -(max - high[i]), upper = -(min - low[i]);
+		__int128 first, last;
+		if (coeff[i] > 0) {
+			first = ceilDiv(lower, coeff[i]);
+			last = floorDiv(upper, coeff[i]);
+		} else {
+			first = ceilDiv(upper, coeff[i]);
+			last = floorDiv(lower, coeff[i]);
+		}
+		for (int digit = 0; digit < radix; ++digit)
+			if (digit < first || digit > last)
+				changed |= remove(i, digit);
+		if (!sizes[i]) {
+			fail(std::string("no digit for ") + names[i]
+			     + " keeps the two sides of an equation in range");
+			return false;
+		}
+	}
+	return changed;
+}
+
+/**
+ * Remove digits that are known for one letter from the others, and check
+ * whether there are enough digits left for all letters.
+ * Returns whether a domain was narrowed.
+ */
+bool Analysis::checkDistinct()
+{
+	bool changed = false;
+	for (int i = 0; i < numLetters; ++i) {
+		if (sizes[i] != 1)
+			continue;
+		int digit = 0;
+		while (!allows(i, digit))
+			++digit;
+		for (int j = 0; j < numLetters; ++j) {
+			if (j == i || !allows(j, digit))
+				continue;
+			changed |= remove(j, digit);
+			if (!sizes[j]) {
+				fail(std::string("both ") + names[i] + " and " + names[j]
+				     + " would have to be " + std::to_string(digit));
+				return false;
+			}
+		}
+	}
+
+	int available = 0;
+	for (int digit = 0; digit < radix; ++digit)
+		for (int i = 0; i < numLetters; ++i)
+			if (allows(i, digit)) {
+				++available;
+				break;
+			}
+	if (available < numLetters)
+		fail(std::to_string(numLetters) + " letters can only take "
+		     + std::to_string(available) + " different digits");
+	return changed;
+}
+
+namespace {
+
+struct Range {
+	__int128 min, max;
+};
+
+} // anonymous namespace
+
+/// Range of the values of @p expr, if it can be bounded without overflow.
+static std::optional<Range> range(const Expr *expr, int radix,
+                                  const std::vector<Range> &digits)
+{
+	auto add = [](__int128 a, __int128 b, __int128 &result) {
+		return !__builtin_add_overflow(a, b, &result);
+	};
+	auto sub = [](__int128 a, __int128 b, __int128 &result) {
+		return !__builtin_sub_overflow(a, b, &result);
+	};
+	auto mul = [](__int128 a, __int128 b, __int128 &result) {
+		return !__builtin_mul_overflow(a, b, &result);
+	};
+
+	switch (expr->getKind()) {
+	case Expr::Kind::Number: {
+		int value = cast<NumberExpr>(expr)->getValue();
+		return Range{value, value};
+	}
+	case Expr::Kind::Word: {
+		std::span<const Letter> word = cast<WordExpr>(expr)->getWord();
+		Range result{0, 0};
+		for (size_t i = word.size(); i-- > 0;) {
+			if (!mul(result.min, radix, result.min)
+					|| !mul(result.max, radix, result.max)
+					|| !add(result.min, digits[word[i]].min, result.min)
+					|| !add(result.max, digits[word[i]].max, result.max))
+				return std::nullopt;
+		}
+		return result;
+	}
+	case Expr::Kind::Equality:
+		return std::nullopt;
+	case Expr::Kind::Binary: {
+		const BinaryExpr* binExpr = cast<BinaryExpr>(expr);
+		std::optional<Range> left = range(binExpr->getLeft(), radix, digits);
+		std::optional<Range> right = range(binExpr->getRight(), radix, digits);
+		if (!left || !right)
+			return std::nullopt;
+		Range result;
+		switch (binExpr->getOp()) {
+		case BinaryExpr::Op::Add:
+			if (!add(left->min, right->min, result.min)
+					|| !add(left->max, right->max, result.max))
+				return std::nullopt;
+			return result;
+		case BinaryExpr::Op::Sub:
+			if (!sub(left->min, right->max, result.min)
+					|| !sub(left->max, right->min, result.max))
+				return std::nullopt;
+			return result;
+		case BinaryExpr::Op::Mul: {
+			__int128 products[4];
+			if (!mul(left->min, right->min, products[0])
+					|| !mul(left->min, right->max, products[1])
+					|| !mul(left->max, right->min, products[2])
+					|| !mul(left->max, right->max, products[3]))
+				return std::nullopt;
+			return Range{*std::min_element(products, products + 4),
+			             *std::max_element(products, products + 4)};
+		}
+		case BinaryExpr::Op::Div:
+			return std::nullopt;
+		}
+		PUZZLE_UNREACHABLE;
+	}
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+/// Check that the ranges of both sides of each equation overlap.
+void Analysis::checkSides(const Puzzle &puzzle)
+{
+	std::vector<Range> digits(numLetters);
+	for (int i = 0; i < numLetters; ++i)
+		digits[i] = {leading[i] ? 1 : 0, radix - 1};
+
+	for (const Expr *root : puzzle.getRoots()) {
+		if (!EqualityExpr::classof(root))
+			continue;
+		const EqualityExpr *eqExpr = cast<EqualityExpr>(root);
+		std::optional<Range> left = range(eqExpr->getLeft(), radix, digits);
+		std::optional<Range> right = range(eqExpr->getRight(), radix, digits);
+		if (!left || !right)
+			continue;
+		if (left->max < right->min)
+			fail("the left side of an equation is at most " + toString(left->max)
+			     + ", but the right side at least " + toString(right->min));
+		else if (right->max < left->min)
+			fail("the left side of an equation is at least "
+			     + toString(left->min) + ", but the right side at most "
+			     + toString(right->max));
+		if (infeasible)
+			return;
+	}
+}
+
+} // namespace puzzle
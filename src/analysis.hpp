@@ -0,0 +1,73 @@
+#ifndef PUZZLE_ANALYSIS
+#define PUZZLE_ANALYSIS
+
+#include "puzzle.hpp"
+#include <string>
+#include <vector>
+
+namespace puzzle {
+
+/**
+ * Static analysis of a puzzle before any search.
+ *
+ * Applies cheap necessary conditions for a solution and narrows the digits
+ * that each letter can take:
+ *
+ *  - there have to be enough digits for all letters, and enough nonzero
+ *    digits for the leading letters;
+ *  - for each row of a LinearEvaluator, the gcd of the coefficients has to
+ *    divide the constant, the row has to be solvable modulo radix-1 and
+ *    modulo radix, and the range of constant + Σ coeff·letter has to contain
+ *    zero;
+ *  - for nonlinear puzzles, the value ranges of the two sides of each
+ *    equation have to overlap.
+ *
+ * Digit domains are narrowed by the residue and range conditions, and a
+ * digit known for one letter is removed from the others, until nothing
+ * changes anymore. Distinctness is otherwise ignored.
+ */
+class Analysis {
+public:
+	/// Uses the rows of @p linear if given, which has to be made for
+	/// @p puzzle, otherwise tries to set up a LinearEvaluator.
+	explicit Analysis(const Puzzle &puzzle,
+	                  const LinearEvaluator *linear = nullptr);
+
+	bool isInfeasible() const { return infeasible; }
+	/// Why the puzzle has no solution, if it is infeasible.
+	const std::string &getReason() const { return reason; }
+
+	bool allows(int letter, int digit) const
+	{
+		return domains[letter * radix + digit];
+	}
+	int getDomainSize(int letter) const { return sizes[letter]; }
+
+	/// Fraction of the digit choices that remain, compared to only
+	/// excluding leading zeros.
+	double getReduction() const;
+
+private:
+	bool remove(int letter, int digit);
+	void fail(std::string why);
+	bool checkRow(int row, const LinearEvaluator &linear);
+	bool checkResidues(const std::vector<__int128> &coeff,
+	                   __int128 constant, int modulus);
+	bool checkRange(const std::vector<__int128> &coeff, __int128 constant);
+	bool checkDistinct();
+	void checkSides(const Puzzle &puzzle);
+
+	int radix;
+	int numLetters;
+	Puzzle::LetterSet leading;
+	std::string names;
+	/// Whether letter i can be digit d, at i·radix+d.
+	std::vector<bool> domains;
+	std::vector<int> sizes;
+	bool infeasible = false;
+	std::string reason;
+};
+
+} // namespace puzzle
+
+#endif
@@ -0,0 +1,99 @@
+#include "async.hpp"
+#include <exception>
+#include <utility>
+
+namespace puzzle {
+
+// BEGIN Implementation of SolveTask
+
+SolveTask::SolveTask(const Puzzle &puzzle, const Evaluator &eval,
+                     SolveOptions options)
+	: puzzle(puzzle), eval(eval), options(std::move(options))
+{
+}
+
+SolveTask::~SolveTask() = default;
+
+SolveResult SolveTask::run()
+{
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point deadline = Clock::time_point::max();
+	if (options.timeLimit != Clock::duration::max())
+		deadline = Clock::now() + options.timeLimit;
+
+	SolveResult result{SolveResult::Status::Completed, {}, 0, {}};
+	if (cancelled.load(std::memory_order_relaxed)) {
+		result.status = SolveResult::Status::Cancelled;
+		return result;
+	}
+
+	Visitor collect = [&](const int *assignment) {
+		result.solutions.emplace_back(assignment,
+		                              assignment + puzzle.getNumLetters());
+		if (options.onSolution && !options.onSolution(assignment)) {
+			result.status = SolveResult::Status::Cancelled;
+			return false;
+		}
+		return true;
+	};
+	Monitor monitor = [&](uint64_t count, double fraction) {
+		explored.store(count, std::memory_order_relaxed);
+		progress.store(fraction, std::memory_order_relaxed);
+		// Nothing to stop anymore at the end.
+		if (fraction >= 1 || result.status != SolveResult::Status::Completed)
+			return true;
+		if (cancelled.load(std::memory_order_relaxed)) {
+			result.status = SolveResult::Status::Cancelled;
+			return false;
+		}
+		if (Clock::now() >= deadline) {
+			result.status = SolveResult::Status::TimedOut;
+			return false;
+		}
+		return true;
+	};
+
+	try {
+		PuzzleSolver(puzzle, eval).solve(collect, monitor);
+	} catch (const std::exception &error) {
+		result.status = SolveResult::Status::Failed;
+		result.error = error.what();
+	}
+
+	if (result.status == SolveResult::Status::Completed)
+		progress.store(1, std::memory_order_relaxed);
+	result.explored = getExplored();
+	return result;
+}
+
+// END Implementation of SolveTask
+
+// BEGIN Implementation of AsyncSolve
+
+AsyncSolve::AsyncSolve(const Puzzle &puzzle, const Evaluator &eval,
+                       SolveOptions options)
+	: task(puzzle, eval, std::move(options)),
+	  thread([this] {
+		result = task.run();
+		done.store(true, std::memory_order_release);
+	  })
+{
+}
+
+AsyncSolve::~AsyncSolve()
+{
+	if (thread.joinable()) {
+		task.cancel();
+		thread.join();
+	}
+}
+
+SolveResult AsyncSolve::wait()
+{
+	thread.join();
+	return std::move(result);
+}
+
+// END Implementation of AsyncSolve
+
+} // namespace puzzle
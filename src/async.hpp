@@ -0,0 +1,113 @@
+#ifndef PUZZLE_ASYNC
+#define PUZZLE_ASYNC
+
+#include "puzzle.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace puzzle {
+
+struct SolveOptions {
+	/// Wall-clock budget, measured from the start of the solve.
+	std::chrono::steady_clock::duration timeLimit
+		= std::chrono::steady_clock::duration::max();
+	/// Called from the solving thread for each solution, returns whether to
+	/// continue.
+	PuzzleSolver::Visitor onSolution;
+};
+
+struct SolveResult {
+	enum class Status {
+		Completed,
+		Cancelled,
+		TimedOut,
+		/// The evaluator threw, e.g. std::overflow_error.
+		Failed,
+	};
+
+	Status status;
+	/// Solutions found, which might be partial if the solve was stopped.
+	std::vector<std::vector<int>> solutions;
+	/// Number of injective maps or search nodes visited.
+	uint64_t explored;
+	/// What went wrong, if the solve failed.
+	std::string error;
+};
+
+/**
+ * Solve that can be observed and stopped from other threads.
+ *
+ * The puzzle is solved like PuzzleSolver does, with the enumeration or search
+ * of the evaluator. Cancellation is cooperative: these check for it, and for
+ * the time limit, every monitorInterval maps or search nodes. Exceptions of
+ * the evaluator are reported as failed result, so that they don't escape
+ * the solving thread.
+ */
+class SolveTask {
+public:
+	/// The puzzle and evaluator have to outlive the task.
+	SolveTask(const Puzzle &puzzle, const Evaluator &eval,
+	          SolveOptions options = {});
+	SolveTask(const SolveTask &) = delete;
+	SolveTask &operator=(const SolveTask &) = delete;
+	~SolveTask();
+
+	SolveResult run();
+	void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+
+	/// Number of injective maps or search nodes visited so far.
+	uint64_t getExplored() const
+	{
+		return explored.load(std::memory_order_relaxed);
+	}
+
+	/// Estimated fraction of the work done so far.
+	double getProgress() const
+	{
+		return progress.load(std::memory_order_relaxed);
+	}
+
+private:
+	const Puzzle &puzzle;
+	const Evaluator &eval;
+	SolveOptions options;
+	std::atomic<bool> cancelled{false};
+	std::atomic<uint64_t> explored{0};
+	std::atomic<double> progress{0};
+};
+
+/**
+ * Runs a SolveTask on a background thread.
+ */
+class AsyncSolve {
+public:
+	/// The puzzle and evaluator have to outlive the solve.
+	AsyncSolve(const Puzzle &puzzle, const Evaluator &eval,
+	           SolveOptions options = {});
+	AsyncSolve(const AsyncSolve &) = delete;
+	AsyncSolve &operator=(const AsyncSolve &) = delete;
+	/// Cancels the solve if it is still running.
+	~AsyncSolve();
+
+	void cancel() { task.cancel(); }
+	bool isDone() const { return done.load(std::memory_order_acquire); }
+	uint64_t getExplored() const { return task.getExplored(); }
+	double getProgress() const { return task.getProgress(); }
+
+	/// Wait for the solve to finish and return the result. Call only once.
+	SolveResult wait();
+
+private:
+	SolveTask task;
+	SolveResult result;
+	std::atomic<bool> done{false};
+	std::thread thread;
+};
+
+} // namespace puzzle
+
+#endif
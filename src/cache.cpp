@@ -0,0 +1,410 @@
+#include "cache.hpp"
+#include "expr.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace puzzle {
+
+// BEGIN Implementation of CanonicalForm
+
+namespace {
+
+/**
+ * Serializes expressions. Operands of additions, multiplications and
+ * equalities are sorted by their shape, in which letters are only described
+ * by properties that don't depend on their name: the number of occurrences in
+ * the puzzle, and the pattern of repetition within the word.
+ */
+class Canonicalizer {
+public:
+	Canonicalizer(int numLetters) : labels(numLetters, -1), counts(numLetters) {}
+
+	void countLetters(const Expr *expr);
+	const std::string &shape(const Expr *expr);
+	void serialize(const Expr *expr, std::string &out) { append(expr, out, true); }
+
+	std::vector<int> labels;
+	int numLabels = 0;
+
+private:
+	using Operand = std::pair<char, const Expr *>;
+
+	void collect(const Expr *expr, BinaryExpr::Op chainOp, char sign,
+	             std::vector<Operand> &operands);
+	std::vector<Operand> sortedOperands(const Expr *expr);
+	void append(const Expr *expr, std::string &out, bool label);
+
+	std::vector<int> counts;
+	std::unordered_map<const Expr *, std::string> shapes;
+};
+
+void Canonicalizer::countLetters(const Expr *expr)
+{
+	switch (expr->getKind()) {
+	case Expr::Kind::Number:
+		return;
+	case Expr::Kind::Word:
+		for (Letter letter : cast<WordExpr>(expr)->getWord())
+			++counts[letter];
+		return;
+	case Expr::Kind::Equality: {
+		const EqualityExpr* eqExpr = cast<EqualityExpr>(expr);
+		countLetters(eqExpr->getLeft());
+		countLetters(eqExpr->getRight());
+		return;
+	}
+	case Expr::Kind::Binary: {
+		const BinaryExpr* binExpr = cast<BinaryExpr>(expr);
+		countLetters(binExpr->getLeft());
+		countLetters(binExpr->getRight());
+		return;
+	}
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+/// Flatten chains of additions/subtractions or multiplications.
+void Canonicalizer::collect(const Expr *expr, BinaryExpr::Op chainOp,
+                            char sign, std::vector<Operand> &operands)
+{
+	if (BinaryExpr::classof(expr)) {
+		const BinaryExpr *binExpr = cast<BinaryExpr>(expr);
+		BinaryExpr::Op op = binExpr->getOp();
+		if (op == chainOp || (chainOp == BinaryExpr::Op::Add
+		                      && op == BinaryExpr::Op::Sub)) {
+			collect(binExpr->getLeft(), chainOp, sign, operands);
+			char rightSign = sign;
+			if (op == BinaryExpr::Op::Sub)
+				rightSign = sign == '+' ? '-' : '+';
+			collect(binExpr->getRight(), chainOp, rightSign, operands);
+			return;
+		}
+	}
+	operands.emplace_back(sign, expr);
+}
+
+std::vector<Canonicalizer::Operand> Canonicalizer::sortedOperands(
+	const Expr *expr)
+{
+	std::vector<Operand> operands;
+	if (EqualityExpr::classof(expr)) {
+		const EqualityExpr* eqExpr = cast<EqualityExpr>(expr);
+		operands.emplace_back('=', eqExpr->getLeft());
+		operands.emplace_back('=', eqExpr->getRight());
+	} else {
+		const BinaryExpr *binExpr = cast<BinaryExpr>(expr);
+		if (binExpr->getOp() == BinaryExpr::Op::Mul)
+			collect(expr, BinaryExpr::Op::Mul, '*', operands);
+		else
+			collect(expr, BinaryExpr::Op::Add, '+', operands);
+	}
+
+	std::stable_sort(operands.begin(), operands.end(),
+		[this](const Operand &a, const Operand &b) {
+			if (a.first != b.first)
+				return a.first < b.first;
+			return shape(a.second) < shape(b.second);
+		});
+	return operands;
+}
+
+const std::string &Canonicalizer::shape(const Expr *expr)
+{
+	auto it = shapes.find(expr);
+	if (it == shapes.end()) {
+		std::string str;
+		append(expr, str, false);
+		it = shapes.emplace(expr, std::move(str)).first;
+	}
+	return it->second;
+}
+
+void Canonicalizer::append(const Expr *expr, std::string &out, bool label)
+{
+	switch (expr->getKind()) {
+	case Expr::Kind::Number:
+		out += '#';
+		out += std::to_string(cast<NumberExpr>(expr)->getValue());
+		return;
+	case Expr::Kind::Word: {
+		std::span<const Letter> word = cast<WordExpr>(expr)->getWord();
+		out += "w(";
+		// Most significant letter first.
+		for (size_t i = word.size(); i-- > 0;) {
+			Letter letter = word[i];
+			if (label) {
+				if (labels[letter] < 0)
+					labels[letter] = numLabels++;
+				out += std::to_string(labels[letter]);
+			} else {
+				size_t first = word.size() - 1;
+				while (word[first] != letter)
+					--first;
+				out += std::to_string(counts[letter]);
+				out += ':';
+				out += std::to_string(word.size() - 1 - first);
+			}
+			out += '.';
+		}
+		out += ')';
+		return;
+	}
+	case Expr::Kind::Binary:
+		if (cast<BinaryExpr>(expr)->getOp() == BinaryExpr::Op::Div) {
+			const BinaryExpr *binExpr = cast<BinaryExpr>(expr);
+			out += "/(";
+			append(binExpr->getLeft(), out, label);
+			out += ',';
+			append(binExpr->getRight(), out, label);
+			out += ')';
+			return;
+		}
+		[[fallthrough]];
+	case Expr::Kind::Equality:
+		out += '(';
+		for (auto [sign, operand] : sortedOperands(expr)) {
+			out += sign;
+			append(operand, out, label);
+		}
+		out += ')';
+		return;
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+} // anonymous namespace
+
+CanonicalForm::CanonicalForm(const Puzzle &puzzle)
+{
+	int numLetters = puzzle.getNumLetters();
+	Canonicalizer canonicalizer(numLetters);
+	for (const Expr *root : puzzle.getRoots())
+		canonicalizer.countLetters(root);
+
+	// Equations commute as well, order them by shape.
+	std::vector<const Expr *> roots(puzzle.getRoots().begin(),
+	                                puzzle.getRoots().end());
+	std::stable_sort(roots.begin(), roots.end(),
+		[&canonicalizer](const Expr *a, const Expr *b) {
+			return canonicalizer.shape(a) < canonicalizer.shape(b);
+		});
+
+	std::string expr;
+	for (const Expr *root : roots) {
+		if (!expr.empty())
+			expr += ',';
+		canonicalizer.serialize(root, expr);
+	}
+
+	// Letters might have been folded away, label them last.
+	for (int i = 0; i < numLetters; ++i)
+		if (canonicalizer.labels[i] < 0)
+			canonicalizer.labels[i] = canonicalizer.numLabels++;
+
+	for (int i = 0; i < numLetters; ++i) {
+		canonical[i] = canonicalizer.labels[i];
+		original[canonical[i]] = i;
+	}
+
+	key = 'r' + std::to_string(puzzle.getRadix())
+		+ ";n" + std::to_string(numLetters) + ';' + expr + ";l";
+	for (int label = 0; label < numLetters; ++label)
+		key += puzzle.getLeading()[original[label]] ? '1' : '0';
+}
+
+// END Implementation of CanonicalForm
+
+// BEGIN Implementation of ResultCache
+
+// File layout: the magic string, followed by records consisting of a header,
+// the key padded to a multiple of four bytes and the solutions, each of which
+// is stored as one int32_t per canonical letter label.
+
+static constexpr char magic[8] = {'P', 'Z', 'C', 'A', 'C', 'H', 'E', '1'};
+
+struct RecordHeader {
+	uint32_t keySize;
+	uint32_t numLetters;
+	uint32_t numSolutions;
+};
+
+static size_t paddedKeySize(uint32_t keySize)
+{
+	return (size_t(keySize) + 3) & ~size_t(3);
+}
+
+ResultCache::ResultCache(const char *path)
+	: indexed(sizeof(magic))
+{
+	fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(), path);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (st.st_size == 0
+			&& write(fd, magic, sizeof(magic)) != sizeof(magic))) {
+		int error = errno;
+		close(fd);
+		throw std::system_error(error, std::generic_category(), path);
+	}
+
+	// Check the magic before anything in the file is interpreted as records.
+	char header[sizeof(magic)];
+	if (pread(fd, header, sizeof(header), 0) != sizeof(header)
+			|| std::memcmp(header, magic, sizeof(magic))) {
+		close(fd);
+		throw std::runtime_error("Not a puzzle cache file");
+	}
+
+	try {
+		remap();
+	} catch (...) {
+		if (data)
+			munmap(const_cast<char *>(data), size);
+		close(fd);
+		throw;
+	}
+}
+
+ResultCache::~ResultCache()
+{
+	munmap(const_cast<char *>(data), size);
+	close(fd);
+}
+
+/**
+ * Length of the record at @p offset, 0 if it is incomplete, or -1 if it is
+ * invalid. No field is trusted before it is checked against the bytes left.
+ */
+static ptrdiff_t recordLength(const char *data, size_t size, size_t offset)
+{
+	size_t remaining = size - offset;
+	if (remaining < sizeof(RecordHeader))
+		return 0;
+	RecordHeader header;
+	std::memcpy(&header, data + offset, sizeof(header));
+	if (header.numLetters > Puzzle::maxNumLetters)
+		return -1;
+	remaining -= sizeof(RecordHeader);
+
+	// None of these can overflow, given the bound on numLetters.
+	uint64_t keySize = paddedKeySize(header.keySize);
+	uint64_t digitsSize = uint64_t(header.numSolutions) * header.numLetters
+		* sizeof(int32_t);
+	if (keySize > remaining || digitsSize > remaining - keySize)
+		return 0;
+	return sizeof(RecordHeader) + keySize + digitsSize;
+}
+
+/// Map the file again if it has grown, and index any new records.
+void ResultCache::remap()
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		throw std::system_error(errno, std::generic_category(), "fstat");
+	if (static_cast<size_t>(st.st_size) == size)
+		return;
+
+	if (data)
+		munmap(const_cast<char *>(data), size);
+	data = nullptr;
+	size = st.st_size;
+	void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED)
+		throw std::system_error(errno, std::generic_category(), "mmap");
+	data = static_cast<const char *>(mapping);
+
+	// A partially written record at the end is ignored until it is complete.
+	// Nothing after an invalid record can be trusted, so indexing stops there.
+	while (!damaged && indexed < size) {
+		ptrdiff_t length = recordLength(data, size, indexed);
+		if (length < 0)
+			damaged = true;
+		if (length <= 0)
+			break;
+		RecordHeader header;
+		std::memcpy(&header, data + indexed, sizeof(header));
+		index.emplace(std::string(data + indexed + sizeof(RecordHeader),
+		                          header.keySize), indexed);
+		indexed += length;
+	}
+}
+
+std::optional<ResultCache::Solutions> ResultCache::lookup(const Puzzle &puzzle)
+{
+	CanonicalForm form(puzzle);
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = index.find(form.getKey());
+	if (it == index.end()) {
+		remap();
+		it = index.find(form.getKey());
+		if (it == index.end())
+			return std::nullopt;
+	}
+
+	RecordHeader header;
+	std::memcpy(&header, data + it->second, sizeof(header));
+	if (header.numLetters != static_cast<uint32_t>(puzzle.getNumLetters()))
+		return std::nullopt;
+
+	const char *digits = data + it->second + sizeof(RecordHeader)
+		+ paddedKeySize(header.keySize);
+	Solutions solutions(header.numSolutions,
+	                    std::vector<int>(header.numLetters));
+	for (uint32_t s = 0; s < header.numSolutions; ++s)
+		for (uint32_t i = 0; i < header.numLetters; ++i) {
+			int32_t digit;
+			std::memcpy(&digit, digits + sizeof(int32_t)
+				* (size_t(s) * header.numLetters + form.toCanonical(i)),
+				sizeof(digit));
+			solutions[s][i] = digit;
+		}
+	return solutions;
+}
+
+void ResultCache::store(const Puzzle &puzzle, const Solutions &solutions)
+{
+	CanonicalForm form(puzzle);
+	const std::string &key = form.getKey();
+	int numLetters = puzzle.getNumLetters();
+	std::lock_guard<std::mutex> lock(mutex);
+
+	remap();
+	// Records after a damaged one would never be found again.
+	if (damaged || index.count(key))
+		return;
+
+	RecordHeader header{static_cast<uint32_t>(key.size()),
+	                    static_cast<uint32_t>(numLetters),
+	                    static_cast<uint32_t>(solutions.size())};
+	std::string record(reinterpret_cast<const char *>(&header), sizeof(header));
+	record += key;
+	record.resize(sizeof(header) + paddedKeySize(header.keySize), '\0');
+	for (const std::vector<int> &solution : solutions)
+		for (int label = 0; label < numLetters; ++label) {
+			int32_t digit = solution[form.fromCanonical(label)];
+			record.append(reinterpret_cast<const char *>(&digit), sizeof(digit));
+		}
+
+	// With O_APPEND, the record is written in one piece at the end.
+	if (write(fd, record.data(), record.size())
+			!= static_cast<ssize_t>(record.size()))
+		throw std::system_error(errno, std::generic_category(), "write");
+	remap();
+}
+
+// END Implementation of ResultCache
+
+} // namespace puzzle
@@ -0,0 +1,68 @@
+#ifndef PUZZLE_CACHE
+#define PUZZLE_CACHE
+
+#include "puzzle.hpp"
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace puzzle {
+
+/**
+ * Canonical form of a puzzle, identical for puzzles that only differ by a
+ * renaming of letters or by the order of operands of commutative operations.
+ *
+ * Operands are ordered by a shape that doesn't depend on letter names, then
+ * letters are relabeled in order of first occurrence.
+ */
+class CanonicalForm {
+public:
+	explicit CanonicalForm(const Puzzle &puzzle);
+
+	const std::string &getKey() const { return key; }
+	int toCanonical(int letter) const { return canonical[letter]; }
+	int fromCanonical(int label) const { return original[label]; }
+
+private:
+	std::string key;
+	int canonical[Puzzle::maxNumLetters];
+	int original[Puzzle::maxNumLetters];
+};
+
+/**
+ * Persistent cache of solution sets, keyed by the canonical form of a puzzle.
+ *
+ * The cache is an append-only file that is memory-mapped for lookups. Records
+ * appended by other processes are picked up when a lookup misses.
+ */
+class ResultCache {
+public:
+	using Solutions = std::vector<std::vector<int>>;
+
+	explicit ResultCache(const char *path);
+	ResultCache(const ResultCache &) = delete;
+	ResultCache &operator=(const ResultCache &) = delete;
+	~ResultCache();
+
+	std::optional<Solutions> lookup(const Puzzle &puzzle);
+	void store(const Puzzle &puzzle, const Solutions &solutions);
+
+private:
+	void remap();
+
+	int fd;
+	const char *data = nullptr;
+	size_t size = 0;
+	size_t indexed;
+	/// Whether an invalid record was found, which ends the index.
+	bool damaged = false;
+	std::unordered_map<std::string, size_t> index;
+	std::mutex mutex;
+};
+
+} // namespace puzzle
+
+#endif
@@ -0,0 +1,82 @@
+#include "compact.hpp"
+#include "util.hpp"
+#include <stdexcept>
+#include <unordered_map>
+
+namespace puzzle {
+
+/// Copy @p expr in post-order, so that children come before their parents.
+CompactAst::Ref CompactAst::add(const Expr *expr,
+                                std::unordered_map<const Expr *, Ref> &refs)
+{
+	auto it = refs.find(expr);
+	if (it != refs.end())
+		return it->second;
+
+	auto nextIndex = [](size_t size) {
+		if (size > Ref::maxIndex)
+			throw std::length_error("Too many nodes");
+		return static_cast<uint32_t>(size);
+	};
+
+	Ref ref;
+	switch (expr->getKind()) {
+	case Expr::Kind::Number:
+		ref = Ref(Expr::Kind::Number, nextIndex(numberValues.size()));
+		numberValues.push_back(cast<NumberExpr>(expr)->getValue());
+		break;
+	case Expr::Kind::Word: {
+		std::span<const Letter> word = cast<WordExpr>(expr)->getWord();
+		ref = Ref(Expr::Kind::Word, nextIndex(wordBegin.size() - 1));
+		letterPool.insert(letterPool.end(), word.begin(), word.end());
+		wordBegin.push_back(letterPool.size());
+		break;
+	}
+	case Expr::Kind::Equality: {
+		const EqualityExpr* eqExpr = cast<EqualityExpr>(expr);
+		Ref left = add(eqExpr->getLeft(), refs);
+		Ref right = add(eqExpr->getRight(), refs);
+		ref = Ref(Expr::Kind::Equality, nextIndex(equalityLeft.size()));
+		equalityLeft.push_back(left);
+		equalityRight.push_back(right);
+		break;
+	}
+	case Expr::Kind::Binary: {
+		const BinaryExpr* binExpr = cast<BinaryExpr>(expr);
+		Ref left = add(binExpr->getLeft(), refs);
+		Ref right = add(binExpr->getRight(), refs);
+		ref = Ref(Expr::Kind::Binary, nextIndex(binaryOp.size()));
+		binaryOp.push_back(binExpr->getOp());
+		binaryLeft.push_back(left);
+		binaryRight.push_back(right);
+		break;
+	}
+	}
+	refs.emplace(expr, ref);
+	return ref;
+}
+
+CompactAst::CompactAst(std::span<const Expr *const> exprs)
+	: wordBegin{0}
+{
+	std::unordered_map<const Expr *, Ref> refs;
+	for (const Expr *expr : exprs)
+		roots.push_back(add(expr, refs));
+}
+
+size_t CompactAst::getNumNodes(Expr::Kind kind) const
+{
+	switch (kind) {
+	case Expr::Kind::Number:
+		return numberValues.size();
+	case Expr::Kind::Word:
+		return wordBegin.size() - 1;
+	case Expr::Kind::Equality:
+		return equalityLeft.size();
+	case Expr::Kind::Binary:
+		return binaryOp.size();
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+} // namespace puzzle
@@ -0,0 +1,153 @@
+#ifndef PUZZLE_COMPACT
+#define PUZZLE_COMPACT
+
+#include "expr.hpp"
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace puzzle {
+
+class Node;
+
+/**
+ * Compact storage for syntax trees.
+ *
+ * Nodes refer to each other by 32-bit references instead of pointers, and the
+ * nodes of each kind are stored contiguously, with one array per field. The
+ * letters of all words are stored in one pool. Shared subtrees stay shared,
+ * and children are stored before their parents.
+ *
+ * Nodes are accessed through the value types NumberNode, WordNode,
+ * EqualityNode and BinaryNode, which support classof and cast like Expr.
+ */
+class CompactAst {
+public:
+	/// Reference to a node: the kind in the upper two bits, the index among
+	/// the nodes of that kind in the others.
+	class Ref {
+	public:
+		static constexpr uint32_t maxIndex = (uint32_t(1) << 30) - 1;
+
+		Ref() = default;
+		Ref(Expr::Kind kind, uint32_t index)
+			: bits(static_cast<uint32_t>(kind) << 30 | index)
+		{
+			assert(index <= maxIndex);
+		}
+
+		Expr::Kind getKind() const { return static_cast<Expr::Kind>(bits >> 30); }
+		uint32_t getIndex() const { return bits & maxIndex; }
+
+		bool operator==(const Ref &) const = default;
+
+	private:
+		uint32_t bits = 0;
+	};
+
+	/// Copy the trees of @p roots. Throws std::length_error if there are too
+	/// many nodes of one kind.
+	explicit CompactAst(std::span<const Expr *const> roots);
+
+	std::span<const Ref> getRoots() const { return roots; }
+	Node getNode(Ref ref) const;
+	/// Number of nodes of the given kind.
+	size_t getNumNodes(Expr::Kind kind) const;
+
+private:
+	friend class NumberNode;
+	friend class WordNode;
+	friend class EqualityNode;
+	friend class BinaryNode;
+
+	Ref add(const Expr *expr, std::unordered_map<const Expr *, Ref> &refs);
+
+	std::vector<Ref> roots;
+
+	std::vector<int> numberValues;
+
+	/// Word i has the letters [wordBegin[i], wordBegin[i+1]) of the pool,
+	/// least significant first.
+	std::vector<uint32_t> wordBegin;
+	std::vector<Letter> letterPool;
+
+	std::vector<Ref> equalityLeft;
+	std::vector<Ref> equalityRight;
+
+	std::vector<BinaryExpr::Op> binaryOp;
+	std::vector<Ref> binaryLeft;
+	std::vector<Ref> binaryRight;
+};
+
+/**
+ * Handle for a node in a CompactAst, which has to outlive it.
+ */
+class Node {
+public:
+	Node(const CompactAst &ast, CompactAst::Ref ref) : ast(&ast), ref(ref) {}
+
+	Expr::Kind getKind() const { return ref.getKind(); }
+	CompactAst::Ref getRef() const { return ref; }
+
+protected:
+	uint32_t getIndex() const { return ref.getIndex(); }
+
+	const CompactAst *ast;
+	CompactAst::Ref ref;
+};
+
+inline Node CompactAst::getNode(Ref ref) const
+{
+	return Node(*this, ref);
+}
+
+class NumberNode : public Node {
+public:
+	explicit NumberNode(Node node) : Node(node) {}
+
+	int getValue() const { return ast->numberValues[getIndex()]; }
+
+	static bool classof(const Node &N) { return N.getKind() == Expr::Kind::Number; }
+};
+
+class WordNode : public Node {
+public:
+	explicit WordNode(Node node) : Node(node) {}
+
+	std::span<const Letter> getWord() const
+	{
+		uint32_t begin = ast->wordBegin[getIndex()];
+		uint32_t end = ast->wordBegin[getIndex() + 1];
+		return std::span<const Letter>(ast->letterPool.data() + begin,
+		                               end - begin);
+	}
+
+	static bool classof(const Node &N) { return N.getKind() == Expr::Kind::Word; }
+};
+
+class EqualityNode : public Node {
+public:
+	explicit EqualityNode(Node node) : Node(node) {}
+
+	Node getLeft() const { return Node(*ast, ast->equalityLeft[getIndex()]); }
+	Node getRight() const { return Node(*ast, ast->equalityRight[getIndex()]); }
+
+	static bool classof(const Node &N) { return N.getKind() == Expr::Kind::Equality; }
+};
+
+class BinaryNode : public Node {
+public:
+	explicit BinaryNode(Node node) : Node(node) {}
+
+	BinaryExpr::Op getOp() const { return ast->binaryOp[getIndex()]; }
+	Node getLeft() const { return Node(*ast, ast->binaryLeft[getIndex()]); }
+	Node getRight() const { return Node(*ast, ast->binaryRight[getIndex()]); }
+
+	static bool classof(const Node &N) { return N.getKind() == Expr::Kind::Binary; }
+};
+
+} // namespace puzzle
+
+#endif
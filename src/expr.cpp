@@ -0,0 +1,182 @@
+#include "expr.hpp"
+#include "util.hpp"
+#include <functional>
+#include <limits>
+#include <string_view>
+#include <utility>
+
+namespace puzzle {
+
+size_t ExprBuilder::KeyHash::operator()(const Key &key) const
+{
+	size_t hash = std::hash<std::string_view>()(std::string_view(
+		reinterpret_cast<const char *>(key.word), key.size));
+	auto combine = [&hash](size_t value) {
+		hash ^= value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+	};
+	combine(static_cast<size_t>(key.kind));
+	combine(std::hash<int>()(key.value));
+	combine(std::hash<const Expr *>()(key.left));
+	combine(std::hash<const Expr *>()(key.right));
+	return hash;
+}
+
+template<typename Create>
+const Expr *ExprBuilder::intern(const Key &key, Create create)
+{
+	auto [it, inserted] = table.try_emplace(key, nullptr);
+	if (inserted)
+		it->second = create();
+	return it->second;
+}
+
+const Expr *ExprBuilder::number(int value)
+{
+	Key key{Expr::Kind::Number};
+	key.value = value;
+	return intern(key, [&] { return NumberExpr::create(arena, value); });
+}
+
+const Expr *ExprBuilder::literal(const unsigned char *digits,
+                                 unsigned numDigits, int value)
+{
+	assert(numDigits > 1 && numDigits <= NumberExpr::maxDigits);
+	Key key{Expr::Kind::Number};
+	key.value = value;
+	key.size = numDigits;
+	std::memcpy(key.word, digits, numDigits);
+	return intern(key, [&] {
+		return NumberExpr::create(arena, value, digits, numDigits);
+	});
+}
+
+const Expr *ExprBuilder::word(const Letter *letters, unsigned size)
+{
+	assert(size <= WordExpr::maxSize);
+	Key key{Expr::Kind::Word};
+	key.size = size;
+	std::memcpy(key.word, letters, size);
+	return intern(key, [&] { return WordExpr::create(arena, letters, size); });
+}
+
+const Expr *ExprBuilder::equality(const Expr *left, const Expr *right)
+{
+	Key key{Expr::Kind::Equality};
+	key.left = left;
+	key.right = right;
+	return intern(key,
+		[&] { return EqualityExpr::create(arena, left, right); });
+}
+
+const Expr *ExprBuilder::binary(
+	BinaryExpr::Op op, const Expr *left, const Expr *right)
+{
+	if (const Expr *folded = fold(op, left, right))
+		return folded;
+
+	Key key{Expr::Kind::Binary};
+	key.value = static_cast<int>(op);
+	key.left = left;
+	key.right = right;
+	return intern(key,
+		[&] { return BinaryExpr::create(arena, op, left, right); });
+}
+
+/// Whether @p expr is a number with the same value in every radix.
+static bool isConstant(const Expr *expr)
+{
+	return NumberExpr::classof(expr)
+		&& !cast<NumberExpr>(expr)->dependsOnRadix();
+}
+
+/// Splits @p expr into a literal factor and the remaining term.
+static std::pair<int, const Expr *> splitFactor(const Expr *expr)
+{
+	if (BinaryExpr::classof(expr)) {
+		const BinaryExpr *binExpr = cast<BinaryExpr>(expr);
+		if (binExpr->getOp() == BinaryExpr::Op::Mul
+				&& isConstant(binExpr->getLeft()))
+			return {cast<NumberExpr>(binExpr->getLeft())->getValue(),
+			        binExpr->getRight()};
+	}
+	return {1, expr};
+}
+
+const Expr *ExprBuilder::fold(
+	BinaryExpr::Op op, const Expr *left, const Expr *right)
+{
+	using enum BinaryExpr::Op;
+
+	// Constant subtrees. We only fold if the result is exact.
+	if (isConstant(left) && isConstant(right)) {
+		int a = cast<NumberExpr>(left)->getValue();
+		int b = cast<NumberExpr>(right)->getValue();
+		int result;
+		switch (op) {
+		case Add:
+			if (__builtin_add_overflow(a, b, &result))
+				return nullptr;
+			return number(result);
+		case Sub:
+			if (__builtin_sub_overflow(a, b, &result))
+				return nullptr;
+			return number(result);
+		case Mul:
+			if (__builtin_mul_overflow(a, b, &result))
+				return nullptr;
+			return number(result);
+		case Div:
+			if (b == 0 || (a == std::numeric_limits<int>::min() && b == -1)
+					|| a % b != 0)
+				return nullptr;
+			return number(a / b);
+		}
+		PUZZLE_UNREACHABLE;
+	}
+
+	switch (op) {
+	case Add:
+	case Sub: {
+		// Neutral elements.
+		if (isConstant(right) && !cast<NumberExpr>(right)->getValue())
+			return left;
+		if (op == Add && isConstant(left) && !cast<NumberExpr>(left)->getValue())
+			return right;
+
+		// Combine a*X+b*X into (a+b)*X, and a*X-b*X into (a-b)*X.
+		auto [a, leftTerm] = splitFactor(left);
+		auto [b, rightTerm] = splitFactor(right);
+		if (leftTerm != rightTerm)
+			return nullptr;
+		int factor;
+		if (op == Add ? __builtin_add_overflow(a, b, &factor)
+		              : __builtin_sub_overflow(a, b, &factor))
+			return nullptr;
+		return binary(Mul, number(factor), leftTerm);
+	}
+	case Mul:
+		// Keep literal factors on the left, so that splitFactor finds them.
+		if (isConstant(right))
+			return binary(Mul, right, left);
+		if (isConstant(left)) {
+			int value = cast<NumberExpr>(left)->getValue();
+			if (value == 0)
+				return left;
+			if (value == 1)
+				return right;
+			// Merge nested literal factors.
+			auto [inner, term] = splitFactor(right);
+			int factor;
+			if (inner != 1 && !__builtin_mul_overflow(value, inner, &factor))
+				return binary(Mul, number(factor), term);
+		}
+		return nullptr;
+	case Div:
+		if (isConstant(right) && cast<NumberExpr>(right)->getValue() == 1)
+			return left;
+		return nullptr;
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+} // namespace puzzle
@@ -7,6 +7,7 @@
 #include <cstring>
 #include <span>
 #include <type_traits>
+#include <unordered_map>
 
 namespace puzzle {
 
@@ -30,23 +31,47 @@ private:
 	const Kind kind;
 };
 
+/**
+ * Integer constant. Literals with more than one digit keep their digits, as
+ * their value depends on the radix they are read in.
+ */
 class NumberExpr : public Expr {
 public:
-	static NumberExpr *create(Arena &arena, int value)
+	/// Enough for any int in radix 2, without leading zeros.
+	static constexpr unsigned maxDigits = 32;
+
+	/// @p digits are least significant first, like the letters of words.
+	static NumberExpr *create(Arena &arena, int value,
+	                          const unsigned char *digits = nullptr,
+	                          unsigned numDigits = 0)
 	{
 		static_assert(std::is_trivially_destructible_v<NumberExpr>);
 		static_assert(alignof(NumberExpr) <= Arena::alignment);
-		return new(arena) NumberExpr(value);
+		assert(numDigits <= maxDigits);
+		return new(arena) NumberExpr(value, digits, numDigits);
 	}
 
 	int getValue() const { return value; }
+	/// Digits of a literal whose value depends on the radix, otherwise empty.
+	std::span<const unsigned char> getDigits() const
+	{
+		return std::span<const unsigned char>(digits, numDigits);
+	}
+	bool dependsOnRadix() const { return numDigits != 0; }
 
 	static bool classof(const Expr *E) { return E->getKind() == Kind::Number; }
 
 private:
-	NumberExpr(int value) : Expr(Kind::Number), value(value) {}
+	NumberExpr(int value, const unsigned char *digits, unsigned numDigits)
+		: Expr(Kind::Number), value(value), numDigits(numDigits)
+	{
+		if (numDigits)
+			std::memcpy(this->digits, digits, numDigits);
+	}
 
 	int value;
+	unsigned numDigits;
+	unsigned char digits[maxDigits];
 };
 
 class WordExpr : public Expr {
@@ -132,6 +157,53 @@ private:
 	const Expr *left, *right;
 };
 
+/**
+ * Creates expressions through an interning table, so that structurally
+ * identical subtrees are represented by the same node. Constant subexpressions
+ * are folded, and sums of equal terms are rewritten into products with a
+ * literal, e.g. X+X into 2*X. Literals whose value depends on the radix are
+ * left alone, so that they keep their digits.
+ */
+class ExprBuilder {
+public:
+	ExprBuilder(Arena &arena) : arena(arena) {}
+	ExprBuilder(const ExprBuilder &) = delete;
+	ExprBuilder &operator=(const ExprBuilder &) = delete;
+
+	const Expr *number(int value);
+	/// Literal with more than one digit, which has @p value in the radix.
+	const Expr *literal(const unsigned char *digits, unsigned numDigits,
+	                    int value);
+	const Expr *word(const Letter *letters, unsigned size);
+	const Expr *equality(const Expr *left, const Expr *right);
+	const Expr *binary(BinaryExpr::Op op, const Expr *left, const Expr *right);
+
+private:
+	/// Since children are interned, they can be compared by address.
+	struct Key {
+		Expr::Kind kind;
+		int value = 0;
+		const Expr *left = nullptr, *right = nullptr;
+		/// Letters of words, or digits of literals.
+		unsigned size = 0;
+		Letter word[NumberExpr::maxDigits] = {};
+
+		bool operator==(const Key &) const = default;
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key &key) const;
+	};
+
+	template<typename Create>
+	const Expr *intern(const Key &key, Create create);
+
+	const Expr *fold(BinaryExpr::Op op, const Expr *left, const Expr *right);
+
+	Arena &arena;
+	std::unordered_map<Key, const Expr *, KeyHash> table;
+};
+
 } // namespace puzzle
 
 #endif
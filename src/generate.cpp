@@ -0,0 +1,347 @@
+#include "generate.hpp"
+#include "expr.hpp"
+#include "puzzle.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace puzzle {
+
+std::vector<std::string> readDictionary(std::istream &in)
+{
+	std::vector<std::string> words;
+	std::string word;
+	while (in >> word) {
+		if (!std::all_of(word.begin(), word.end(),
+				[](unsigned char c) { return std::isalpha(c); }))
+			continue;
+		for (char &c : word)
+			c = std::toupper(static_cast<unsigned char>(c));
+		words.push_back(std::move(word));
+	}
+	return words;
+}
+
+static uint32_t letterMask(const std::string &text)
+{
+	uint32_t mask = 0;
+	for (char c : text)
+		if (c >= 'A' && c <= 'Z')
+			mask |= uint32_t(1) << (c - 'A');
+	return mask;
+}
+
+/**
+ * Rows of a linear pattern, with a placeholder letter for each slot. A word
+ * in a slot gets the coefficient of the placeholder, times radixᵏ for its
+ * k-th letter from the right.
+ */
+struct Generator::Template {
+	explicit Template(const Puzzle &puzzle) : form(puzzle) {}
+
+	LinearForm form;
+	/// Index of each fixed letter in the rows.
+	int fixedIndex[26];
+	/// Index of the placeholder of each slot in the rows.
+	std::vector<int> slotIndex;
+	/// Fixed letters that can't be zero.
+	uint32_t leading = 0;
+};
+
+/// Whether the character continues a word or number.
+static bool continuesTerm(char c)
+{
+	return std::isalnum(static_cast<unsigned char>(c));
+}
+
+Generator::Generator(std::vector<std::string> dictionary, const char *pattern,
+                     int radix)
+	: radix(radix), numSlots(0), maxCarryDigits(0)
+{
+	std::sort(dictionary.begin(), dictionary.end());
+	dictionary.erase(std::unique(dictionary.begin(), dictionary.end()),
+	                 dictionary.end());
+	for (std::string &text : dictionary) {
+		if (text.size() > WordExpr::maxSize)
+			continue;
+		uint32_t letters = letterMask(text);
+		unsigned length = text.size();
+		words.push_back({std::move(text), letters, length});
+	}
+
+	// Split the pattern into literal text and slots.
+	literals.emplace_back();
+	for (const char *cur = pattern; *cur; ++cur) {
+		if (*cur >= 'a' && *cur <= 'z') {
+			while (cur[1] >= 'a' && cur[1] <= 'z')
+				++cur;
+			++numSlots;
+			literals.emplace_back();
+		} else {
+			literals.back() += *cur;
+		}
+	}
+	if (numSlots == 0)
+		throw std::invalid_argument("Pattern has no slots for words");
+	fixedLetters = 0;
+	for (const std::string &literal : literals)
+		fixedLetters |= letterMask(literal);
+
+	pureSum = numSlots >= 2 && literals.front().empty()
+		&& literals.back().empty() && literals[numSlots - 1] == "=";
+	for (unsigned i = 1; i + 1 < numSlots; ++i)
+		pureSum = pureSum && literals[i] == "+";
+
+	if (pureSum) {
+		// The sum of k summands with at most n digits is less than k·radixⁿ.
+		for (uint64_t power = 1; power < numSlots - 1; power *= radix)
+			++maxCarryDigits;
+	}
+
+	// A placeholder only stands for a word if the slot isn't glued to other
+	// letters or digits.
+	bool separate = std::popcount(fixedLetters) + numSlots <= 26;
+	for (unsigned slot = 0; slot < numSlots; ++slot) {
+		const std::string &before = literals[slot], &after = literals[slot + 1];
+		separate = separate && (before.empty() || !continuesTerm(before.back()))
+			&& (after.empty() || !continuesTerm(after.front()));
+	}
+	if (!separate)
+		return;
+
+	std::string placeholders, text = literals[0];
+	for (char c = 'A'; placeholders.size() < numSlots; ++c)
+		if (!(fixedLetters & uint32_t(1) << (c - 'A'))) {
+			placeholders += c;
+			text += c;
+			text += literals[placeholders.size()];
+		}
+	Puzzle puzzle(text.c_str(), radix);
+	try {
+		parsed = std::make_unique<Template>(puzzle);
+	} catch (const Unsupported &) {
+		return;
+	}
+	parsed->slotIndex.resize(numSlots);
+	for (int i = 0; i < puzzle.getNumLetters(); ++i) {
+		size_t slot = placeholders.find(puzzle[i]);
+		if (slot != std::string::npos) {
+			parsed->slotIndex[slot] = i;
+		} else {
+			parsed->fixedIndex[puzzle[i] - 'A'] = i;
+			if (puzzle.getLeading()[i])
+				parsed->leading |= uint32_t(1) << (puzzle[i] - 'A');
+		}
+	}
+}
+
+Generator::~Generator() = default;
+
+class Generator::Worker {
+public:
+	Worker(const Generator &generator, const Callback &found,
+	       std::mutex &foundMutex)
+		: generator(generator), found(found), foundMutex(foundMutex),
+		  choice(generator.numSlots), puzzle({}, {}, generator.radix) {}
+
+	void start(size_t first);
+	GeneratorStats stats;
+
+private:
+	void fill(unsigned slot, uint32_t letters, unsigned maxLength);
+	void check(uint32_t letters);
+	int solveParsed(uint32_t letters);
+	int solveText();
+
+	const Generator &generator;
+	const Callback &found;
+	std::mutex &foundMutex;
+	std::vector<size_t> choice;
+	/// Reused for all candidates.
+	std::string text;
+	/// Set up again for every candidate of a parsed pattern.
+	Puzzle puzzle;
+	std::vector<LinearForm::Row> rows;
+	std::unique_ptr<LinearEvaluator> eval;
+};
+
+void Generator::Worker::start(size_t first)
+{
+	const Word &word = generator.words[first];
+	if (generator.numSlots == 1)
+		++stats.candidates;
+	uint32_t letters = generator.fixedLetters | word.letters;
+	if (std::popcount(letters) > generator.radix)
+		return;
+	choice[0] = first;
+	fill(1, letters, word.length);
+}
+
+void Generator::Worker::fill(unsigned slot, uint32_t letters,
+                             unsigned maxLength)
+{
+	if (slot == generator.numSlots) {
+		check(letters);
+		return;
+	}
+
+	bool isLast = slot == generator.numSlots - 1;
+	bool isResult = generator.pureSum && isLast;
+	// Summands commute, so we only take them in nondecreasing order.
+	size_t first = generator.pureSum && slot > 0 && !isResult
+		? choice[slot - 1] : 0;
+
+	for (size_t i = first; i < generator.words.size(); ++i) {
+		const Word &word = generator.words[i];
+		if (isLast)
+			++stats.candidates;
+		uint32_t newLetters = letters | word.letters;
+		if (std::popcount(newLetters) > generator.radix)
+			continue;
+		if (isResult && (word.length < maxLength
+				|| word.length > maxLength + generator.maxCarryDigits))
+			continue;
+		choice[slot] = i;
+		fill(slot + 1, newLetters, std::max(maxLength, word.length));
+	}
+}
+
+void Generator::Worker::check(uint32_t letters)
+{
+	text.clear();
+	for (unsigned slot = 0; slot < generator.numSlots; ++slot) {
+		text += generator.literals[slot];
+		text += generator.words[choice[slot]].text;
+	}
+	text += generator.literals.back();
+
+	// Candidates that can't be set up or overflow are counted as failed, as
+	// throwing would end the program from a worker thread.
+	int numSolutions;
+	try {
+		numSolutions = generator.parsed ? solveParsed(letters) : solveText();
+	} catch (const std::exception &) {
+		++stats.failed;
+		return;
+	} catch (const Unsupported &) {
+		++stats.failed;
+		return;
+	}
+
+	++stats.solved;
+	if (numSolutions == 1) {
+		++stats.unique;
+		std::lock_guard<std::mutex> lock(foundMutex);
+		found(text);
+	}
+}
+
+/// Solve by substituting the words into the rows of the pattern, reusing
+/// the evaluator of the previous candidate. Stops at the second solution.
+int Generator::Worker::solveParsed(uint32_t letters)
+{
+	const Template &parsed = *generator.parsed;
+	char order[26];
+	int index[26];
+	int numLetters = 0;
+	for (int c = 0; c < 26; ++c)
+		if (letters & uint32_t(1) << c) {
+			index[c] = numLetters;
+			order[numLetters++] = 'A' + c;
+		}
+
+	Puzzle::LetterSet leading;
+	for (int c = 0; c < 26; ++c)
+		if (parsed.leading & uint32_t(1) << c)
+			leading[index[c]] = true;
+	for (unsigned slot = 0; slot < generator.numSlots; ++slot)
+		leading[index[generator.words[choice[slot]].text[0] - 'A']] = true;
+
+	std::span<const LinearForm::Row> pattern = parsed.form.getRows();
+	rows.resize(pattern.size());
+	for (size_t r = 0; r < pattern.size(); ++r) {
+		LinearForm::Row &row = rows[r];
+		row = LinearForm::Row{};
+		row.constant = pattern[r].constant;
+		for (int c = 0; c < 26; ++c)
+			if (generator.fixedLetters & uint32_t(1) << c)
+				row.coeff[index[c]].add(pattern[r].coeff[parsed.fixedIndex[c]]);
+		for (unsigned slot = 0; slot < generator.numSlots; ++slot) {
+			const LinearForm::Polynomial &factor
+				= pattern[r].coeff[parsed.slotIndex[slot]];
+			const std::string &word = generator.words[choice[slot]].text;
+			for (size_t k = 0; k < word.size(); ++k)
+				row.coeff[index[word[word.size() - 1 - k] - 'A']].add(factor, k);
+		}
+	}
+
+	puzzle = Puzzle(std::span<const char>(order, numLetters), leading,
+	                generator.radix);
+	if (eval)
+		eval->reset(rows);
+	else
+		eval = std::make_unique<LinearEvaluator>(puzzle, rows);
+
+	// Stop as soon as we know the solution isn't unique.
+	int numSolutions = 0;
+	PuzzleSolver(puzzle, *eval).solve(
+		[&numSolutions](const int *) { return ++numSolutions < 2; });
+	return numSolutions;
+}
+
+/// Solve by parsing the text, for patterns that can't be substituted into.
+int Generator::Worker::solveText()
+{
+	Puzzle puzzle(text.c_str(), generator.radix);
+	std::unique_ptr<Evaluator> eval;
+	try {
+		eval = std::make_unique<LinearEvaluator>(puzzle);
+	} catch (const Unsupported &) {
+		eval = std::make_unique<GenericEvaluator>(puzzle);
+	}
+
+	int numSolutions = 0;
+	PuzzleSolver(puzzle, *eval).solve(
+		[&numSolutions](const int *) { return ++numSolutions < 2; });
+	return numSolutions;
+}
+
+GeneratorStats Generator::run(const Callback &found, unsigned numThreads) const
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::atomic<size_t> next{0};
+	std::mutex foundMutex, statsMutex;
+	GeneratorStats total;
+
+	// Threads take turns choosing the word for the first slot.
+	auto work = [&] {
+		Worker worker(*this, found, foundMutex);
+		size_t i;
+		while ((i = next.fetch_add(1, std::memory_order_relaxed)) < words.size())
+			worker.start(i);
+		std::lock_guard<std::mutex> lock(statsMutex);
+		total.candidates += worker.stats.candidates;
+		total.solved += worker.stats.solved;
+		total.failed += worker.stats.failed;
+		total.unique += worker.stats.unique;
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
+		threads.emplace_back(work);
+	work();
+	for (std::thread &thread : threads)
+		thread.join();
+
+	return total;
+}
+
+} // namespace puzzle
@@ -0,0 +1,80 @@
+#ifndef PUZZLE_GENERATE
+#define PUZZLE_GENERATE
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace puzzle {
+
+/// Read words consisting of letters, converted to uppercase.
+std::vector<std::string> readDictionary(std::istream &in);
+
+struct GeneratorStats {
+	/// Complete word choices considered, including those rejected by
+	/// filters. Partial choices that are pruned aren't counted.
+	uint64_t candidates = 0;
+	/// Candidates that were solved.
+	uint64_t solved = 0;
+	/// Candidates that passed the filters, but couldn't be set up or solved,
+	/// e.g. as a word got too long or the evaluation overflowed.
+	uint64_t failed = 0;
+	/// Candidates with exactly one solution.
+	uint64_t unique = 0;
+};
+
+/**
+ * Generates alphametics with exactly one solution from a dictionary.
+ *
+ * The pattern is a puzzle in which each run of lowercase letters is a slot to
+ * be filled with a dictionary word, e.g. "word+word=word". Candidates with
+ * more letters than the radix, or that can't satisfy length constraints, are
+ * rejected without solving. The remaining ones are solved until a second
+ * solution is found.
+ *
+ * Linear patterns whose slots are separate words are parsed only once. Each
+ * candidate then just substitutes the letters of its words into the rows.
+ */
+class Generator {
+public:
+	/// Called for every puzzle with a unique solution.
+	using Callback = std::function<void(const std::string &puzzle)>;
+
+	/// Throws std::logic_error if the pattern can't be parsed.
+	Generator(std::vector<std::string> dictionary, const char *pattern,
+	          int radix);
+	~Generator();
+
+	/// Run with the given number of threads, or one per core if 0.
+	GeneratorStats run(const Callback &found, unsigned numThreads = 0) const;
+
+private:
+	struct Word {
+		std::string text;
+		uint32_t letters;
+		unsigned length;
+	};
+
+	struct Template;
+	class Worker;
+
+	int radix;
+	std::vector<Word> words;
+	/// Text before each slot, and after the last one.
+	std::vector<std::string> literals;
+	unsigned numSlots;
+	uint32_t fixedLetters;
+	/// Whether the pattern has the form word+...+word=word.
+	bool pureSum;
+	/// How many digits the result can be longer than the longest summand.
+	unsigned maxCarryDigits;
+	/// The parsed pattern, if it is linear and has separate slots.
+	std::unique_ptr<Template> parsed;
+};
+
+} // namespace puzzle
+
+#endif
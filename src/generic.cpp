@@ -1,44 +1,161 @@
+#include "compact.hpp"
 #include "expr.hpp"
 #include "puzzle.hpp"
 #include "util.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 
 namespace puzzle {
 
-static fraction<int64_t> eval(
-	const Expr* expr, int radix, const int *assignment)
+/// 128-bit integer that throws on overflow.
+struct CheckedInt {
+	__int128 value;
+
+	CheckedInt(__int128 value = 0) : value(value) {}
+
+	CheckedInt operator-() const { return CheckedInt(0) - *this; }
+	bool operator==(const CheckedInt &) const = default;
+
+	friend CheckedInt operator+(CheckedInt a, CheckedInt b)
+	{
+		__int128 result;
+		if (__builtin_add_overflow(a.value, b.value, &result))
+			throw std::overflow_error("Overflow in puzzle evaluation");
+		return result;
+	}
+
+	friend CheckedInt operator-(CheckedInt a, CheckedInt b)
+	{
+		__int128 result;
+		if (__builtin_sub_overflow(a.value, b.value, &result))
+			throw std::overflow_error("Overflow in puzzle evaluation");
+		return result;
+	}
+
+	friend CheckedInt operator*(CheckedInt a, CheckedInt b)
+	{
+		__int128 result;
+		if (__builtin_mul_overflow(a.value, b.value, &result))
+			throw std::overflow_error("Overflow in puzzle evaluation");
+		return result;
+	}
+};
+
+using Magnitude = unsigned __int128;
+
+static Magnitude saturatingAdd(Magnitude a, Magnitude b)
+{
+	Magnitude result;
+	if (__builtin_add_overflow(a, b, &result))
+		return std::numeric_limits<Magnitude>::max();
+	return result;
+}
+
+static Magnitude saturatingMul(Magnitude a, Magnitude b)
 {
+	Magnitude result;
+	if (__builtin_mul_overflow(a, b, &result))
+		return std::numeric_limits<Magnitude>::max();
+	return result;
+}
+
+/// Bounds for the magnitude of numerator and denominator of a fraction.
+struct Bound {
+	Magnitude num, denom;
+};
+
+/**
+ * Bound the magnitude of the fraction that @p expr evaluates to, following the
+ * arithmetic in fraction.hpp. The largest magnitude of any intermediate value
+ * is accumulated into @p peak.
+ */
+static Bound bound(const Expr* expr, int radix, Magnitude &peak)
+{
+	Bound result;
 	switch (expr->getKind()) {
-	case Expr::Kind::Number:
-		return fraction<int64_t>(cast<NumberExpr>(expr)->getValue());
+	case Expr::Kind::Number: {
+		int value = cast<NumberExpr>(expr)->getValue();
+		result = {value < 0 ? -Magnitude(value) : Magnitude(value), 1};
+		break;
+	}
 	case Expr::Kind::Word: {
-		const WordExpr* wordExpr = cast<WordExpr>(expr);
-		int64_t res = 0, val = 1;
-		for (Letter letter : wordExpr->getWord()) {
-			res += assignment[letter] * val;
-			val *= radix;
-		}
-		return fraction<int64_t>(res);
+		Magnitude power = 1;
+		for (size_t i = 0; i < cast<WordExpr>(expr)->getWord().size(); ++i)
+			power = saturatingMul(power, radix);
+		result = {power - 1, 1};
+		break;
 	}
 	case Expr::Kind::Equality: {
 		const EqualityExpr* eqExpr = cast<EqualityExpr>(expr);
-		return eval(eqExpr->getLeft(), radix, assignment)
-			== eval(eqExpr->getRight(), radix, assignment);
+		Bound left = bound(eqExpr->getLeft(), radix, peak);
+		Bound right = bound(eqExpr->getRight(), radix, peak);
+		result = {std::max(saturatingMul(left.num, right.denom),
+		                   saturatingMul(left.denom, right.num)), 1};
+		break;
 	}
 	case Expr::Kind::Binary: {
 		const BinaryExpr* binExpr = cast<BinaryExpr>(expr);
+		Bound left = bound(binExpr->getLeft(), radix, peak);
+		Bound right = bound(binExpr->getRight(), radix, peak);
 		switch (binExpr->getOp()) {
 		case BinaryExpr::Op::Add:
-			return eval(binExpr->getLeft(), radix, assignment)
-				+ eval(binExpr->getRight(), radix, assignment);
 		case BinaryExpr::Op::Sub:
-			return eval(binExpr->getLeft(), radix, assignment)
-				- eval(binExpr->getRight(), radix, assignment);
+			result = {saturatingAdd(saturatingMul(left.num, right.denom),
+			                        saturatingMul(right.num, left.denom)),
+			          saturatingMul(left.denom, right.denom)};
+			break;
 		case BinaryExpr::Op::Mul:
-			return eval(binExpr->getLeft(), radix, assignment)
-				* eval(binExpr->getRight(), radix, assignment);
+			result = {saturatingMul(left.num, right.num),
+			          saturatingMul(left.denom, right.denom)};
+			break;
 		case BinaryExpr::Op::Div:
-			return eval(binExpr->getLeft(), radix, assignment)
-				/ eval(binExpr->getRight(), radix, assignment);
+			result = {saturatingMul(left.num, right.denom),
+			          saturatingMul(left.denom, right.num)};
+			break;
+		}
+		break;
+	}
+	}
+	peak = std::max({peak, result.num, result.denom});
+	return result;
+}
+
+template<typename T>
+static fraction<T> eval(Node node, int radix, const int *assignment)
+{
+	switch (node.getKind()) {
+	case Expr::Kind::Number:
+		return fraction<T>(cast<NumberNode>(node).getValue());
+	case Expr::Kind::Word: {
+		std::span<const Letter> word = cast<WordNode>(node).getWord();
+		// Horner's method from the most significant letter, so that no
+		// intermediate value exceeds the result.
+		T res = 0;
+		for (size_t i = word.size(); i-- > 0;)
+			res = res * radix + assignment[word[i]];
+		return fraction<T>(res);
+	}
+	case Expr::Kind::Equality: {
+		EqualityNode eqNode = cast<EqualityNode>(node);
+		return fraction<T>(T(eval<T>(eqNode.getLeft(), radix, assignment)
+			== eval<T>(eqNode.getRight(), radix, assignment)));
+	}
+	case Expr::Kind::Binary: {
+		BinaryNode binNode = cast<BinaryNode>(node);
+		switch (binNode.getOp()) {
+		case BinaryExpr::Op::Add:
+			return eval<T>(binNode.getLeft(), radix, assignment)
+				+ eval<T>(binNode.getRight(), radix, assignment);
+		case BinaryExpr::Op::Sub:
+			return eval<T>(binNode.getLeft(), radix, assignment)
+				- eval<T>(binNode.getRight(), radix, assignment);
+		case BinaryExpr::Op::Mul:
+			return eval<T>(binNode.getLeft(), radix, assignment)
+				* eval<T>(binNode.getRight(), radix, assignment);
+		case BinaryExpr::Op::Div:
+			return eval<T>(binNode.getLeft(), radix, assignment)
+				/ eval<T>(binNode.getRight(), radix, assignment);
 		}
 		PUZZLE_UNREACHABLE;
 	}
@@ -46,13 +163,83 @@ static fraction<int64_t> eval(
 	PUZZLE_UNREACHABLE;
 }
 
+static void collectLetters(const Expr *expr, Puzzle::LetterSet &letters)
+{
+	switch (expr->getKind()) {
+	case Expr::Kind::Number:
+		return;
+	case Expr::Kind::Word:
+		for (Letter letter : cast<WordExpr>(expr)->getWord())
+			letters[letter] = true;
+		return;
+	case Expr::Kind::Equality: {
+		const EqualityExpr* eqExpr = cast<EqualityExpr>(expr);
+		collectLetters(eqExpr->getLeft(), letters);
+		collectLetters(eqExpr->getRight(), letters);
+		return;
+	}
+	case Expr::Kind::Binary: {
+		const BinaryExpr* binExpr = cast<BinaryExpr>(expr);
+		collectLetters(binExpr->getLeft(), letters);
+		collectLetters(binExpr->getRight(), letters);
+		return;
+	}
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+GenericEvaluator::GenericEvaluator(const Puzzle &puzzle)
+	: Evaluator(puzzle), ast(puzzle.getRoots())
+{
+	Magnitude peak = 0;
+	for (size_t i = 0; i < puzzle.getRoots().size(); ++i) {
+		const Expr *root = puzzle.getRoots()[i];
+		Equation equation{ast.getRoots()[i], {}};
+		collectLetters(root, equation.letters);
+		equations.push_back(equation);
+		bound(root, puzzle.getRadix(), peak);
+	}
+	std::stable_sort(equations.begin(), equations.end(),
+		[](const Equation &a, const Equation &b) {
+			return a.letters.count() < b.letters.count();
+		});
+
+	if (peak <= std::numeric_limits<int64_t>::max())
+		width = Width::Int64;
+	else if (peak <= std::numeric_limits<__int128>::max())
+		width = Width::Int128;
+	else
+		width = Width::Checked;
+}
+
+bool GenericEvaluator::checkConstraint(int equation,
+                                       const int *assignment) const
+{
+	Node root = ast.getNode(equations[equation].root);
+	int radix = puzzle.getRadix();
+	switch (width) {
+	case Width::Int32:
+	case Width::Int64:
+		return static_cast<bool>(eval<int64_t>(root, radix, assignment));
+	case Width::Int128:
+		return static_cast<bool>(eval<__int128>(root, radix, assignment));
+	case Width::Checked:
+		return static_cast<bool>(eval<CheckedInt>(root, radix, assignment));
+	}
+	PUZZLE_UNREACHABLE;
+}
+
 bool GenericEvaluator::operator()(const int *assignment) const
 {
 	auto leading = puzzle.getLeading();
 	for (int i = 0; i < puzzle.getNumLetters(); ++i)
 		if (!assignment[i] && leading[i])
 			return false;
-	return eval(puzzle.getRoot(), puzzle.getRadix(), assignment) != 0;
+
+	for (size_t i = 0; i < equations.size(); ++i)
+		if (!checkConstraint(i, assignment))
+			return false;
+	return true;
 }
 
 } // namespace puzzle
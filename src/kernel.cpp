@@ -0,0 +1,117 @@
+#include "kernel.hpp"
+#include "puzzle.hpp"
+#include <array>
+#include <utility>
+
+namespace puzzle {
+
+/**
+ * Algorithm M from MapGen with the assignment in a fixed-size local array,
+ * fused with the evaluation. If Radix is 0, the radix is taken at runtime.
+ */
+template<typename T, int N, int Radix>
+static int linearKernel(const T *coeffIn, T constant, uint32_t leading,
+                        int radix, const Visitor &visit, const Monitor &monitor)
+{
+	const int n = Radix ? Radix : radix;
+	T coeff[N];
+	int map[N];
+	for (int i = 0; i < N; ++i) {
+		coeff[i] = coeffIn[i];
+		map[i] = i;
+	}
+
+	int numSolutions = 0;
+	uint64_t explored = 0;
+	unsigned untilPoll = monitorInterval;
+	for (;;) {
+		// M1. Visit map.
+		++explored;
+		T sum = constant;
+		for (int i = 0; i < N; ++i)
+			sum += coeff[i] * map[i];
+		if (sum == 0) {
+			bool valid = true;
+			for (int i = 0; i < N; ++i)
+				if (!map[i] && (leading >> i & 1))
+					valid = false;
+			if (valid) {
+				++numSolutions;
+				if (!visit(map))
+					break;
+			}
+		}
+		if (!--untilPoll) {
+			untilPoll = monitorInterval;
+			if (monitor && !monitor(explored, explored / MapGen::count(N, n)))
+				break;
+		}
+
+		// M2. Find j.
+		int j = N - 2;
+		while (j >= 0 && map[j] >= map[j+1])
+			--j;
+		if (j >= 0) {
+			// M3. Next aⱼ.
+			int l = N - 1;
+			while (map[j] >= map[l])
+				--l;
+			std::swap(map[j], map[l]);
+		}
+
+		// M4. Reverse aⱼ₊₁, ..., aₘ.
+		for (int k = j + 1, l = N - 1; k < l; ++k, --l)
+			std::swap(map[k], map[l]);
+
+		if (j < 0) {
+			// M5. Next combination.
+			j = N - 1;
+			while (j >= 0 && map[j] == j + (n - N))
+				--j;
+			if (j < 0)
+				break;
+			int l = map[j];
+			while (j < N)
+				map[j++] = ++l;
+		}
+	}
+
+	if (monitor)
+		monitor(explored, explored / MapGen::count(N, n));
+	return numSolutions;
+}
+
+template<typename T, int Radix, int... N>
+static constexpr auto makeTable(std::integer_sequence<int, N...>)
+{
+	return std::array<LinearKernel<T>, sizeof...(N)>{
+		&linearKernel<T, N + 1, Radix>...};
+}
+
+/// Kernels for numLetters = 1, ..., Size with the given radix, 0 for any.
+template<typename T, int Radix, int Size>
+static constexpr auto table =
+	makeTable<T, Radix>(std::make_integer_sequence<int, Size>());
+
+template<typename T>
+LinearKernel<T> selectLinearKernel(int numLetters, int radix)
+{
+	if (numLetters < 1 || numLetters > radix)
+		return nullptr;
+
+	switch (radix) {
+	case 10:
+		return table<T, 10, 10>[numLetters - 1];
+	case 16:
+		return table<T, 16, 16>[numLetters - 1];
+	default:
+		if (numLetters > Puzzle::maxNumLetters)
+			return nullptr;
+		return table<T, 0, Puzzle::maxNumLetters>[numLetters - 1];
+	}
+}
+
+template LinearKernel<int32_t> selectLinearKernel(int, int);
+template LinearKernel<int64_t> selectLinearKernel(int, int);
+
+} // namespace puzzle
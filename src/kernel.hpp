@@ -0,0 +1,48 @@
+#ifndef PUZZLE_KERNEL
+#define PUZZLE_KERNEL
+
+#include <cstdint>
+#include <functional>
+
+namespace puzzle {
+
+/// Called for each solution, returns whether to continue.
+using Visitor = std::function<bool(const int *assignment)>;
+
+/**
+ * Called by long enumerations and searches every monitorInterval maps or
+ * search nodes with the number explored so far and the estimated fraction of
+ * the work done, returns whether to continue. It is called once more at the
+ * end, when the fraction is 1 if the work was completed, and the return value
+ * of that call is ignored.
+ */
+using Monitor = std::function<bool(uint64_t explored, double progress)>;
+
+/// Checking the clock and flags is cheap, but not free.
+inline constexpr unsigned monitorInterval = 1 << 14;
+
+/**
+ * Enumerates all injective maps and checks the linear equation
+ * constant + Σ coeff[i]·map[i] = 0 for each, in one loop that is specialized
+ * for the number of letters and possibly the radix. Letters with a bit set in
+ * @p leading can't be zero. Returns the number of solutions visited.
+ */
+template<typename T>
+using LinearKernel = int (*)(const T *coeff, T constant, uint32_t leading,
+                             int radix, const Visitor &visit,
+                             const Monitor &monitor);
+
+/// Select a specialized kernel, or return nullptr if there is none.
+///
+/// Only linear puzzles have kernels: for the others, evaluating the syntax
+/// tree dominates, and a loop specialized for the letter count gained less
+/// than 3% over MapGen.
+template<typename T>
+LinearKernel<T> selectLinearKernel(int numLetters, int radix);
+
+extern template LinearKernel<int32_t> selectLinearKernel(int, int);
+extern template LinearKernel<int64_t> selectLinearKernel(int, int);
+
+} // namespace puzzle
+
+#endif
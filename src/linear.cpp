@@ -1,50 +1,180 @@
 #include "expr.hpp"
 #include "puzzle.hpp"
 #include "util.hpp"
+#include <algorithm>
+#include <limits>
 
 namespace puzzle {
 
-LinearEvaluator::LinearEvaluator(const Puzzle &puzzle) :
-	puzzle(puzzle), coeff{}, constant(0)
+/// Coefficients that overflow even 128 bits are left to GenericEvaluator.
+static __int128 checkedAdd(__int128 a, __int128 b)
+{
+	__int128 result;
+	if (__builtin_add_overflow(a, b, &result))
+		throw Unsupported{};
+	return result;
+}
+
+static __int128 checkedMul(__int128 a, __int128 b)
+{
+	__int128 result;
+	if (__builtin_mul_overflow(a, b, &result))
+		throw Unsupported{};
+	return result;
+}
+
+static __int128 checkedAbs(__int128 a)
+{
+	return a < 0 ? checkedMul(a, -1) : a;
+}
+
+template<typename T>
+static bool fits(__int128 value)
+{
+	return value <= std::numeric_limits<T>::max();
+}
+
+static __int128 gcd(__int128 a, __int128 b)
+{
+	a = a < 0 ? -a : a;
+	b = b < 0 ? -b : b;
+	while (b) {
+		__int128 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/// Bound the magnitude of all partial sums of the row, or throw Unsupported.
+template<typename T>
+static __int128 rowBound(const T &row, int numLetters, int radix)
+{
+	__int128 bound = checkedAbs(row.constant);
+	for (int i = 0; i < numLetters; ++i)
+		bound = checkedAdd(bound, checkedMul(checkedAbs(row.coeff[i]),
+		                                     radix - 1));
+	return bound;
+}
+
+template<typename T>
+static Puzzle::LetterSet rowLetters(const T &row, int numLetters)
+{
+	Puzzle::LetterSet letters;
+	for (int i = 0; i < numLetters; ++i)
+		letters[i] = row.coeff[i] != 0;
+	return letters;
+}
+
+__int128 LinearForm::Polynomial::operator()(int radix) const
+{
+	__int128 value = 0;
+	for (size_t k = size; k-- > 0;)
+		value = checkedAdd(checkedMul(value, radix), coeff[k]);
+	return value;
+}
+
+void LinearForm::Polynomial::add(const Polynomial &other, unsigned shift)
 {
-	addCoeff(puzzle.getRoot(), 1);
+	for (unsigned k = 0; k < size; ++k) {
+		if (!other.coeff[k])
+			continue;
+		if (k + shift >= size)
+			throw Unsupported{};
+		coeff[k + shift] = checkedAdd(coeff[k + shift], other.coeff[k]);
+	}
 }
 
-void LinearEvaluator::addCoeff(const Expr* expr, int factor)
+using Polynomial = LinearForm::Polynomial;
+
+static Polynomial multiply(const Polynomial &a, const Polynomial &b)
+{
+	Polynomial product{};
+	for (unsigned k = 0; k < Polynomial::size; ++k) {
+		if (!b.coeff[k])
+			continue;
+		Polynomial term{};
+		for (unsigned j = 0; j < Polynomial::size; ++j)
+			term.coeff[j] = checkedMul(a.coeff[j], b.coeff[k]);
+		product.add(term, k);
+	}
+	return product;
+}
+
+static Polynomial negate(const Polynomial &a)
+{
+	Polynomial result{};
+	for (unsigned k = 0; k < Polynomial::size; ++k)
+		result.coeff[k] = checkedMul(a.coeff[k], -1);
+	return result;
+}
+
+/// Numbers are constant, unless they are literals with several digits.
+static Polynomial numberPolynomial(const NumberExpr *numExpr)
+{
+	Polynomial result{};
+	std::span<const unsigned char> digits = numExpr->getDigits();
+	if (digits.empty())
+		result.coeff[0] = numExpr->getValue();
+	for (unsigned k = 0; k < digits.size(); ++k)
+		result.coeff[k] = digits[k];
+	return result;
+}
+
+LinearForm::LinearForm(const Puzzle &puzzle)
+{
+	for (const Expr *root : puzzle.getRoots()) {
+		Row row{};
+		add(row, root, Polynomial{{1}});
+		rows.push_back(row);
+	}
+}
+
+void LinearForm::add(Row &row, const Expr *expr, const Polynomial &factor)
 {
 	switch (expr->getKind()) {
 	case Expr::Kind::Number:
-		constant += factor * cast<NumberExpr>(expr)->getValue();
+		row.constant.add(
+			multiply(factor, numberPolynomial(cast<NumberExpr>(expr))));
 		return;
 	case Expr::Kind::Word: {
 		const WordExpr* wordExpr = cast<WordExpr>(expr);
 		std::span<const Letter> word = wordExpr->getWord();
-		for (unsigned i = 0; i < word.size(); ++i) {
-			coeff[word[i]] += factor;
-			factor *= puzzle.getRadix();
-		}
+		for (unsigned i = 0; i < word.size(); ++i)
+			row.coeff[word[i]].add(factor, i);
 		return;
 	}
 	case Expr::Kind::Equality: {
 		const EqualityExpr* eqExpr = cast<EqualityExpr>(expr);
-		addCoeff(eqExpr->getLeft(), factor);
-		addCoeff(eqExpr->getRight(), -factor);
+		add(row, eqExpr->getLeft(), factor);
+		add(row, eqExpr->getRight(), negate(factor));
 		return;
 	}
 	case Expr::Kind::Binary: {
 		const BinaryExpr* binExpr = cast<BinaryExpr>(expr);
 		switch (binExpr->getOp()) {
 		case BinaryExpr::Op::Add:
-			addCoeff(binExpr->getLeft(), factor);
-			addCoeff(binExpr->getRight(), factor);
+			add(row, binExpr->getLeft(), factor);
+			add(row, binExpr->getRight(), factor);
 			return;
 		case BinaryExpr::Op::Sub:
-			addCoeff(binExpr->getLeft(), factor);
-			addCoeff(binExpr->getRight(), -factor);
+			add(row, binExpr->getLeft(), factor);
+			add(row, binExpr->getRight(), negate(factor));
 			return;
 		case BinaryExpr::Op::Mul:
+			// Multiplication with literals, as produced by folding X+X.
+			if (NumberExpr::classof(binExpr->getLeft())) {
+				add(row, binExpr->getRight(), multiply(factor,
+					numberPolynomial(cast<NumberExpr>(binExpr->getLeft()))));
+				return;
+			}
+			if (NumberExpr::classof(binExpr->getRight())) {
+				add(row, binExpr->getLeft(), multiply(factor,
+					numberPolynomial(cast<NumberExpr>(binExpr->getRight()))));
+				return;
+			}
+			throw Unsupported{};
 		case BinaryExpr::Op::Div:
-			// TODO: We could support multiplication with literals.
 			throw Unsupported{};
 		}
 		PUZZLE_UNREACHABLE;
@@ -53,6 +183,167 @@ void LinearEvaluator::addCoeff(const Expr* expr, int factor)
 	PUZZLE_UNREACHABLE;
 }
 
+LinearEvaluator::LinearEvaluator(const Puzzle &puzzle) :
+	LinearEvaluator(puzzle, LinearForm(puzzle))
+{
+}
+
+LinearEvaluator::LinearEvaluator(const Puzzle &puzzle, const LinearForm &form) :
+	LinearEvaluator(puzzle, form.getRows())
+{
+}
+
+LinearEvaluator::LinearEvaluator(const Puzzle &puzzle,
+                                 std::span<const LinearForm::Row> form) :
+	Evaluator(puzzle)
+{
+	reset(form);
+}
+
+void LinearEvaluator::reset(std::span<const LinearForm::Row> form)
+{
+	wide.clear();
+	rows32.clear();
+	rows64.clear();
+	kernel32 = nullptr;
+	kernel64 = nullptr;
+
+	int radix = puzzle.getRadix();
+	for (const LinearForm::Row &polynomials : form) {
+		Coefficients<__int128> row{};
+		for (int i = 0; i < puzzle.getNumLetters(); ++i)
+			row.coeff[i] = polynomials.coeff[i](radix);
+		row.constant = polynomials.constant(radix);
+		wide.push_back(row);
+	}
+	deriveRows();
+
+	int numLetters = puzzle.getNumLetters();
+	std::stable_sort(wide.begin(), wide.end(),
+		[numLetters](const auto &a, const auto &b) {
+			return rowLetters(a, numLetters).count()
+				< rowLetters(b, numLetters).count();
+		});
+
+	// Bound the magnitude of all partial sums in operator().
+	__int128 maxBound = 0;
+	for (const Coefficients<__int128> &row : wide)
+		maxBound = std::max(maxBound,
+		                    rowBound(row, numLetters, puzzle.getRadix()));
+
+	if (fits<int32_t>(maxBound)) {
+		width = Width::Int32;
+		rows32.resize(wide.size());
+		for (size_t r = 0; r < wide.size(); ++r) {
+			for (int i = 0; i < Puzzle::maxNumLetters; ++i)
+				rows32[r].coeff[i] = wide[r].coeff[i];
+			rows32[r].constant = wide[r].constant;
+		}
+		if (wide.size() == 1)
+			kernel32 = selectLinearKernel<int32_t>(numLetters,
+			                                       puzzle.getRadix());
+	} else if (fits<int64_t>(maxBound)) {
+		width = Width::Int64;
+		rows64.resize(wide.size());
+		for (size_t r = 0; r < wide.size(); ++r) {
+			for (int i = 0; i < Puzzle::maxNumLetters; ++i)
+				rows64[r].coeff[i] = wide[r].coeff[i];
+			rows64[r].constant = wide[r].constant;
+		}
+		if (wide.size() == 1)
+			kernel64 = selectLinearKernel<int64_t>(numLetters,
+			                                       puzzle.getRadix());
+	} else {
+		width = Width::Int128;
+	}
+}
+
+/**
+ * Eliminate letters between pairs of equations. Derived rows are implied by
+ * the puzzle, and we keep the one with the fewest letters per pair if that
+ * has fewer letters than both equations, so that it can be checked earlier
+ * in the search. Rows whose partial sums might overflow are skipped, they
+ * aren't needed for correctness.
+ */
+void LinearEvaluator::deriveRows()
+{
+	int numLetters = puzzle.getNumLetters();
+	size_t numEquations = wide.size();
+	for (size_t i = 0; i < numEquations; ++i)
+		for (size_t j = i + 1; j < numEquations; ++j) {
+			size_t bestCount = std::min(rowLetters(wide[i], numLetters).count(),
+			                            rowLetters(wide[j], numLetters).count());
+			Coefficients<__int128> best;
+			bool found = false;
+
+			for (int l = 0; l < numLetters; ++l) {
+				__int128 a = wide[i].coeff[l], b = wide[j].coeff[l];
+				if (!a || !b)
+					continue;
+				__int128 g = gcd(a, b);
+				a /= g;
+				b /= g;
+
+				Coefficients<__int128> row;
+				try {
+					for (int k = 0; k < Puzzle::maxNumLetters; ++k)
+						row.coeff[k] = checkedAdd(checkedMul(wide[i].coeff[k], b),
+						                          checkedMul(wide[j].coeff[k], -a));
+					row.constant = checkedAdd(checkedMul(wide[i].constant, b),
+					                          checkedMul(wide[j].constant, -a));
+					rowBound(row, numLetters, puzzle.getRadix());
+				} catch (const Unsupported &) {
+					continue;
+				}
+
+				size_t count = rowLetters(row, numLetters).count();
+				if (count < bestCount) {
+					best = row;
+					bestCount = count;
+					found = true;
+				}
+			}
+
+			if (found) {
+				// Keep numbers small.
+				__int128 g = best.constant;
+				for (int k = 0; k < numLetters; ++k)
+					g = gcd(g, best.coeff[k]);
+				if (g > 1) {
+					for (int k = 0; k < numLetters; ++k)
+						best.coeff[k] /= g;
+					best.constant /= g;
+				}
+				wide.push_back(best);
+			}
+		}
+}
+
+Puzzle::LetterSet LinearEvaluator::getConstraintLetters(int row) const
+{
+	return rowLetters(wide[row], puzzle.getNumLetters());
+}
+
+template<typename T>
+bool LinearEvaluator::evaluate(const Coefficients<T> &coeffs,
+                               const int *assignment) const
+{
+	T result = coeffs.constant;
+	for (int i = 0; i != puzzle.getNumLetters(); ++i)
+		result += coeffs.coeff[i] * assignment[i];
+	return result == 0;
+}
+
+template<typename T>
+bool LinearEvaluator::evaluate(const std::vector<Coefficients<T>> &rows,
+                               const int *assignment) const
+{
+	for (const Coefficients<T> &row : rows)
+		if (!evaluate(row, assignment))
+			return false;
+	return true;
+}
+
 bool LinearEvaluator::operator()(const int *assignment) const
 {
 	std::bitset<Puzzle::maxNumLetters> leading = puzzle.getLeading();
@@ -60,10 +351,45 @@ bool LinearEvaluator::operator()(const int *assignment) const
 		if (!assignment[i] && leading[i])
 			return false;
 
-	int result = constant;
-	for (int i = 0; i != puzzle.getNumLetters(); ++i)
-		result += coeff[i] * assignment[i];
-	return result == 0;
+	switch (width) {
+	case Width::Int32:
+		return evaluate(rows32, assignment);
+	case Width::Int64:
+		return evaluate(rows64, assignment);
+	case Width::Int128:
+		return evaluate(wide, assignment);
+	case Width::Checked:
+		PUZZLE_UNREACHABLE;
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+bool LinearEvaluator::checkConstraint(int row, const int *assignment) const
+{
+	switch (width) {
+	case Width::Int32:
+		return evaluate(rows32[row], assignment);
+	case Width::Int64:
+		return evaluate(rows64[row], assignment);
+	case Width::Int128:
+		return evaluate(wide[row], assignment);
+	case Width::Checked:
+		PUZZLE_UNREACHABLE;
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+int LinearEvaluator::enumerate(const Visitor &visit,
+                               const Monitor &monitor) const
+{
+	uint32_t leading = puzzle.getLeading().to_ulong();
+	if (kernel32)
+		return kernel32(rows32[0].coeff, rows32[0].constant, leading,
+		                puzzle.getRadix(), visit, monitor);
+	if (kernel64)
+		return kernel64(rows64[0].coeff, rows64[0].constant, leading,
+		                puzzle.getRadix(), visit, monitor);
+	return Evaluator::enumerate(visit, monitor);
 }
 
 } // namespace puzzle
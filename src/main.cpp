@@ -1,7 +1,22 @@
 #include "puzzle.hpp"
+#include "cache.hpp"
+#include "generate.hpp"
+#include "native.hpp"
+#include "server.hpp"
+#include "sweep.hpp"
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <pthread.h>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
 
 static constexpr char usage[] = R"#(
 Finds all ways to replace letters by digits to satisfy the given equation.
@@ -11,17 +26,46 @@ The equation should be of the form expr=expr, where an expr is
     - a sequence of uppercase letters ([A-Z]+),
     - composites: expr+expr, expr-expr, expr*expr, expr/expr.
 
+Several comma-separated equations over the same letters are solved jointly.
+
 Different letters are replaced by different digits. Leading digits are not
-allowed to be 0. The computation happens with 64-bit precision, and there is no
-check for overflow.
+allowed to be 0. The computation uses the narrowest integer type that can't
+overflow for the given puzzle, with up to 128 bits. Beyond that, overflow is
+checked and reported as an error.
 
 If no radix is given, numbers are interpreted as decimal.
+
+Options:
+    -c FILE  Cache results in FILE. Puzzles that only differ by the naming of
+             letters or the order of operands share cache entries.
+    -l SOCK  Serve requests on the UNIX domain socket SOCK. Each line of the
+             form "SOLVE radix timeout_ms equation" is answered with the
+             letters, the solutions as they are found and a status line.
+             SOCK must not exist, or be a socket nobody listens on. SIGINT
+             and SIGTERM stop the server and remove the socket.
+    -g DICT  Generate puzzles with a unique solution from the words in DICT.
+             The equation is a pattern in which every run of lowercase letters
+             is replaced by dictionary words, e.g. word+word=word.
+    -s FROM-TO
+             Solve for every radix from FROM to TO and print a summary. The
+             puzzle is only parsed once, and the radices are solved in
+             parallel. Can't be combined with other options or a radix.
+    -n       Generate and compile native code for the puzzle. Compiled code is
+             cached in $PUZZLE_NATIVE_CACHE, or in puzzle-native in
+             $XDG_CACHE_HOME or ~/.cache. It has to be private to the user.
 )#";
 
 using namespace puzzle;
 
-std::unique_ptr<Evaluator> createEvaluator(const Puzzle& puzzle)
+std::unique_ptr<Evaluator> createEvaluator(const Puzzle& puzzle, bool native)
 {
+	if (native) {
+		try {
+			return std::make_unique<NativeEvaluator>(puzzle);
+		} catch (const Unsupported&) {
+			std::cout << "Native code generation failed, interpreting.\n";
+		}
+	}
 	try {
 		return std::make_unique<LinearEvaluator>(puzzle);
 	} catch(const Unsupported&) {
@@ -29,27 +73,230 @@ std::unique_ptr<Evaluator> createEvaluator(const Puzzle& puzzle)
 	}
 }
 
+static int generate(const char *dictPath, const char *pattern, int radix)
+{
+	std::ifstream dictFile(dictPath);
+	if (!dictFile) {
+		std::cerr << "Can't open dictionary " << dictPath << '\n';
+		return 1;
+	}
+	std::unique_ptr<Generator> parsed;
+	try {
+		parsed = std::make_unique<Generator>(readDictionary(dictFile), pattern,
+		                                     radix);
+	} catch (const std::logic_error &error) {
+		std::cerr << "Can't parse " << pattern << ": " << error.what() << '\n';
+		return 1;
+	}
+	const Generator &generator = *parsed;
+
+	auto start = std::chrono::steady_clock::now();
+	GeneratorStats stats = generator.run(
+		[](const std::string &puzzle) { std::cout << puzzle << '\n'; });
+	std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+	std::cout << stats.unique << " unique puzzles from " << stats.candidates
+	          << " candidates (" << stats.candidates / time.count()
+	          << " per second): " << stats.solved << " solved, "
+	          << stats.candidates - stats.solved - stats.failed
+	          << " rejected early, " << stats.failed << " failed.\n";
+	return 0;
+}
+
+/// Open the cache at @p path, if given, or report why it can't be used.
+static bool openCache(const char *path, std::unique_ptr<ResultCache> &cache)
+{
+	if (!path)
+		return true;
+	try {
+		cache = std::make_unique<ResultCache>(path);
+		return true;
+	} catch (const std::exception &error) {
+		std::cerr << "Can't use cache " << path << ": " << error.what() << '\n';
+		return false;
+	}
+}
+
+static int serve(const char *socketPath, const char *cachePath, bool native)
+{
+	std::unique_ptr<ResultCache> cache;
+	if (!openCache(cachePath, cache))
+		return 1;
+
+	// SIGINT and SIGTERM stop the server, so that it removes its socket.
+	// They are blocked in all threads and taken by a waiting thread, as
+	// stop() isn't async-signal-safe.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	ServerOptions options;
+	options.cache = cache.get();
+	options.native = native;
+	std::unique_ptr<Server> server;
+	try {
+		server = std::make_unique<Server>(socketPath, options);
+	} catch (const std::system_error &error) {
+		std::cerr << "Can't listen on " << error.what() << '\n';
+		return 1;
+	}
+	std::thread waiter([&] {
+		int signal;
+		sigwait(&signals, &signal);
+		server->stop();
+	});
+
+	std::cout << "Listening on " << socketPath << ".\n";
+	server->run();
+	// Wake the waiter if the server stopped otherwise.
+	pthread_kill(waiter.native_handle(), SIGTERM);
+	waiter.join();
+	return 0;
+}
+
+static int sweep(const char *puzzle, int from, int to)
+{
+	std::unique_ptr<RadixSweep> parsed;
+	try {
+		parsed = std::make_unique<RadixSweep>(puzzle, from, to);
+	} catch (const std::logic_error &error) {
+		std::cerr << "Can't parse " << puzzle << ": " << error.what() << '\n';
+		return 1;
+	}
+	const RadixSweep &sweep = *parsed;
+	const Puzzle &letters = sweep.getPuzzle();
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<SweepResult> results = sweep.run();
+	std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+	std::cout << "Radix  Solutions     Time  First solution (";
+	for (int i = 0; i < letters.getNumLetters(); ++i)
+		std::cout << (i ? " " : "") << letters[i];
+	std::cout << ")\n";
+
+	std::vector<int> unique;
+	for (const SweepResult &result : results) {
+		std::cout << std::setw(5) << result.radix << "  ";
+		switch (result.status) {
+		case SweepResult::Status::TooManyLetters:
+			std::cout << "too many letters\n";
+			continue;
+		case SweepResult::Status::Overflow:
+			std::cout << "overflow\n";
+			continue;
+		case SweepResult::Status::Solved:
+			break;
+		}
+		std::cout << std::setw(9) << result.numSolutions << "  "
+		          << std::fixed << std::setprecision(3) << std::setw(6)
+		          << result.seconds << "s ";
+		for (int digit : result.solution)
+			std::cout << ' ' << digit;
+		std::cout << '\n';
+		if (result.numSolutions == 1)
+			unique.push_back(result.radix);
+	}
+
+	std::cout << "Radices with a unique solution:";
+	for (int radix : unique)
+		std::cout << ' ' << radix;
+	std::cout << "\nSwept " << results.size() << " radices in "
+	          << time.count() << "s.\n";
+	return 0;
+}
+
+static int printUsage(const char *name)
+{
+	std::cout << "Usage: " << name << " [-c cache] [-g dict] [-n] [radix] equation\n"
+		<< "       " << name << " [-c cache] [-n] -l socket\n"
+		<< "       " << name << " -s from-to equation\n"
+		<< usage << "\nExample: " << name << " SEND+MORE=MONEY\n";
+	return 1;
+}
+
 int main(int argc, char **argv)
 {
-	if (argc < 2 || argc > 3) {
-		std::cout << "Usage: " << argv[0] << " [radix] equation\n"
-			<< usage << "\nExample: " << argv[0] << " SEND+MORE=MONEY\n";
+	const char *cachePath = nullptr;
+	const char *dictPath = nullptr;
+	const char *socketPath = nullptr;
+	int sweepFrom = 0, sweepTo = 0;
+	bool native = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:g:l:ns:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cachePath = optarg;
+			break;
+		case 'g':
+			dictPath = optarg;
+			break;
+		case 'l':
+			socketPath = optarg;
+			break;
+		case 'n':
+			native = true;
+			break;
+		case 's':
+			if (std::sscanf(optarg, "%d-%d", &sweepFrom, &sweepTo) != 2
+					|| sweepFrom < 2 || sweepFrom > sweepTo)
+				return printUsage(argv[0]);
+			break;
+		default:
+			return printUsage(argv[0]);
+		}
+	}
+
+	if (sweepFrom && (cachePath || dictPath || socketPath || native
+	                  || argc - optind != 1)) {
+		std::cerr << "-s can't be combined with -c, -g, -l, -n or a radix\n";
 		return 1;
 	}
+	if (socketPath)
+		return serve(socketPath, cachePath, native);
+
+	int numArgs = argc - optind;
+	if (numArgs < 1 || numArgs > 2)
+		return printUsage(argv[0]);
 
 	// extract puzzle out of command line
 	int nRad = 10;
-	if (argc > 2)	// then there is a radix argument
-		nRad = atoi(argv[1]);
+	if (numArgs > 1)	// then there is a radix argument
+		nRad = atoi(argv[optind]);
+
+	if (dictPath)
+		return generate(dictPath, argv[argc-1], nRad);
+	if (sweepFrom)
+		return sweep(argv[argc-1], sweepFrom, sweepTo);
 
-	Puzzle puzzle(argv[argc-1], nRad);
+	std::unique_ptr<Puzzle> parsed;
+	try {
+		parsed = std::make_unique<Puzzle>(argv[argc-1], nRad);
+	} catch (const std::logic_error &error) {
+		std::cerr << "Can't parse " << argv[argc-1] << ": " << error.what()
+		          << '\n';
+		return 1;
+	}
+	const Puzzle &puzzle = *parsed;
 	std::cout << "There are " << puzzle.getNumLetters()
 	          << " different letters.\n";
 
-	std::unique_ptr<Evaluator> eval = createEvaluator(puzzle);
-	PuzzleSolver solver(puzzle, *eval);
+	std::unique_ptr<ResultCache> cache;
+	if (!openCache(cachePath, cache))
+		return 1;
+
+	std::unique_ptr<Evaluator> eval = createEvaluator(puzzle, native);
+	PuzzleSolver solver(puzzle, *eval, cache.get());
 
-	int numSolutions = solver.print_solutions(std::cout, true);
+	int numSolutions;
+	try {
+		numSolutions = solver.print_solutions(std::cout, true);
+	} catch (const std::overflow_error &error) {
+		std::cout << error.what() << '\n';
+		return 1;
+	}
 	std::cout << numSolutions << " solutions found.\n";
 
 	return 0;
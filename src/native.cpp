@@ -0,0 +1,402 @@
+#include "native.hpp"
+#include "expr.hpp"
+#include "util.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace puzzle {
+
+// BEGIN Implementation of code generation
+
+static std::string literal(__int128 value)
+{
+	if (value > std::numeric_limits<int64_t>::min()
+			&& value <= std::numeric_limits<int64_t>::max())
+		return "((T)" + std::to_string(static_cast<long long>(value)) + "LL)";
+	return "W(" + std::to_string(static_cast<long long>(value >> 64)) + "LL, "
+		+ std::to_string(static_cast<unsigned long long>(value)) + "ULL)";
+}
+
+static const char *typeName(Width width)
+{
+	switch (width) {
+	case Width::Int32:
+		return "int";
+	case Width::Int64:
+		return "long long";
+	case Width::Int128:
+		return "__int128";
+	case Width::Checked:
+		throw Unsupported{};
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+namespace {
+
+/**
+ * Emits one local variable per node of the expression, so that shared
+ * subtrees are only evaluated once.
+ */
+class ExprEmitter {
+public:
+	ExprEmitter(std::ostream &out, int radix) : out(out), radix(radix) {}
+
+	const std::string &emit(const Expr *expr);
+
+private:
+	std::ostream &out;
+	int radix;
+	std::unordered_map<const Expr *, std::string> names;
+};
+
+const std::string &ExprEmitter::emit(const Expr *expr)
+{
+	auto it = names.find(expr);
+	if (it != names.end())
+		return it->second;
+
+	std::string value;
+	switch (expr->getKind()) {
+	case Expr::Kind::Number:
+		value = "F{" + literal(cast<NumberExpr>(expr)->getValue()) + ", 1}";
+		break;
+	case Expr::Kind::Word: {
+		std::span<const Letter> word = cast<WordExpr>(expr)->getWord();
+		std::string number = "(T)0";
+		for (size_t i = word.size(); i-- > 0;)
+			number = "(" + number + " * " + std::to_string(radix)
+				+ " + a[" + std::to_string(word[i]) + "])";
+		value = "F{" + number + ", 1}";
+		break;
+	}
+	case Expr::Kind::Equality: {
+		const EqualityExpr* eqExpr = cast<EqualityExpr>(expr);
+		std::string left = emit(eqExpr->getLeft());
+		std::string right = emit(eqExpr->getRight());
+		value = "F{(T)f_eq(" + left + ", " + right + "), 1}";
+		break;
+	}
+	case Expr::Kind::Binary: {
+		const BinaryExpr* binExpr = cast<BinaryExpr>(expr);
+		std::string left = emit(binExpr->getLeft());
+		std::string right = emit(binExpr->getRight());
+		const char *function = nullptr;
+		switch (binExpr->getOp()) {
+		case BinaryExpr::Op::Add:
+			function = "f_add";
+			break;
+		case BinaryExpr::Op::Sub:
+			function = "f_sub";
+			break;
+		case BinaryExpr::Op::Mul:
+			function = "f_mul";
+			break;
+		case BinaryExpr::Op::Div:
+			function = "f_div";
+			break;
+		}
+		value = std::string(function) + "(" + left + ", " + right + ")";
+		break;
+	}
+	}
+
+	std::string name = "v";
+	name += std::to_string(names.size());
+	out << "\tconst F " << name << " = " << value << ";\n";
+	return names.emplace(expr, std::move(name)).first->second;
+}
+
+} // anonymous namespace
+
+std::string NativeEvaluator::generate(const Puzzle &puzzle)
+{
+	// Systems of equations are better served by the constraint search.
+	int numLetters = puzzle.getNumLetters();
+	if (numLetters < 1 || puzzle.getRoots().size() != 1)
+		throw Unsupported{};
+
+	std::unique_ptr<LinearEvaluator> linear;
+	try {
+		linear = std::make_unique<LinearEvaluator>(puzzle);
+	} catch (const Unsupported &) {}
+	Width width = linear ? linear->getWidth()
+	                     : GenericEvaluator(puzzle).getWidth();
+
+	std::ostringstream out;
+	out << "// Generated for letters";
+	for (int i = 0; i < numLetters; ++i)
+		out << ' ' << puzzle[i];
+	out << " in radix " << puzzle.getRadix() << ".\n\n"
+		<< "typedef " << typeName(width) << " T;\n"
+		<< "#define W(hi, lo) ((T)(((unsigned __int128)(hi) << 64) | (lo)))\n"
+		<< "enum { N = " << numLetters << ", R = " << puzzle.getRadix()
+		<< ", I = " << monitorInterval << " };\n\n"
+		<< "struct F { T n, d; };\n"
+		<< "static inline F f_add(F a, F b) "
+		   "{ return F{a.n * b.d + b.n * a.d, a.d * b.d}; }\n"
+		<< "static inline F f_sub(F a, F b) "
+		   "{ return F{a.n * b.d - b.n * a.d, a.d * b.d}; }\n"
+		<< "static inline F f_mul(F a, F b) "
+		   "{ return F{a.n * b.n, a.d * b.d}; }\n"
+		<< "static inline F f_div(F a, F b) "
+		   "{ return F{a.n * b.d, a.d * b.n}; }\n"
+		<< "static inline int f_eq(F a, F b) "
+		   "{ return a.n * b.d == a.d * b.n; }\n\n";
+
+	out << "static inline int check(const int *a)\n{\n";
+	for (int i = 0; i < numLetters; ++i)
+		if (puzzle.getLeading()[i])
+			out << "\tif (!a[" << i << "]) return 0;\n";
+	if (linear) {
+		out << "\tT s = " << literal(linear->getConstant(0)) << ";\n";
+		for (int i = 0; i < numLetters; ++i)
+			if (linear->getCoeff(0, i))
+				out << "\ts += " << literal(linear->getCoeff(0, i))
+				    << " * a[" << i << "];\n";
+		out << "\treturn s == 0;\n";
+	} else {
+		ExprEmitter emitter(out, puzzle.getRadix());
+		const std::string &root = emitter.emit(puzzle.getRoots()[0]);
+		out << "\treturn " << root << ".n != 0;\n";
+	}
+	out << "}\n\n";
+
+	// Algorithm M, see MapGen.
+	out << R"(extern "C" int puzzle_check(const int *a)
+{
+	return check(a);
+}
+
+extern "C" int puzzle_enumerate(int (*visit)(void *, const int *),
+                                int (*poll)(void *, unsigned long long),
+                                void *ctx, unsigned long long *explored)
+{
+	int map[N];
+	for (int i = 0; i < N; ++i)
+		map[i] = i;
+
+	int numSolutions = 0;
+	unsigned long long count = 0;
+	unsigned untilPoll = I;
+	for (;;) {
+		++count;
+		if (check(map)) {
+			++numSolutions;
+			if (!visit(ctx, map))
+				break;
+		}
+		if (!--untilPoll) {
+			untilPoll = I;
+			if (!poll(ctx, count))
+				break;
+		}
+
+		int j = N - 2;
+		while (j >= 0 && map[j] >= map[j+1])
+			--j;
+		if (j >= 0) {
+			int l = N - 1;
+			while (map[j] >= map[l])
+				--l;
+			int t = map[j]; map[j] = map[l]; map[l] = t;
+		}
+		for (int k = j + 1, l = N - 1; k < l; ++k, --l) {
+			int t = map[k]; map[k] = map[l]; map[l] = t;
+		}
+		if (j < 0) {
+			j = N - 1;
+			while (j >= 0 && map[j] == j + (R - N))
+				--j;
+			if (j < 0)
+				break;
+			int l = map[j];
+			while (j < N)
+				map[j++] = ++l;
+		}
+	}
+	*explored = count;
+	return numSolutions;
+}
+)";
+	return out.str();
+}
+
+// END Implementation of code generation
+
+// BEGIN Implementation of NativeEvaluator
+
+/// A directory of the user, as objects in it are loaded into the process.
+static std::string defaultCacheDir()
+{
+	const char *dir = std::getenv("PUZZLE_NATIVE_CACHE");
+	if (dir && *dir)
+		return dir;
+	const char *cache = std::getenv("XDG_CACHE_HOME");
+	if (cache && *cache)
+		return std::string(cache) + "/puzzle-native";
+	const char *home = std::getenv("HOME");
+	if (!home || !*home)
+		throw Unsupported{};
+	std::string parent = std::string(home) + "/.cache";
+	mkdir(parent.c_str(), 0700);
+	return parent + "/puzzle-native";
+}
+
+/**
+ * Whether @p path is a file of the given type that only the current user can
+ * modify. Symbolic links are not followed, so they are refused.
+ */
+static bool isPrivate(const std::string &path, mode_t type)
+{
+	struct stat st;
+	return lstat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == type
+		&& st.st_uid == geteuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/// Compiler invocation without input and output.
+static std::string compilerCommand()
+{
+	const char *cxx = std::getenv("CXX");
+	return std::string(cxx && *cxx ? cxx : "c++")
+		+ " -std=c++20 -O2 -shared -fPIC";
+}
+
+static std::string shellQuote(const std::string &str)
+{
+	std::string quoted = "'";
+	for (char c : str) {
+		if (c == '\'')
+			quoted += "'\\''";
+		else
+			quoted += c;
+	}
+	return quoted + "'";
+}
+
+/// Compile @p source into the shared object @p object, unless it exists.
+static void compile(const std::string &command, const std::string &source,
+                    const std::string &object)
+{
+	struct stat st;
+	if (lstat(object.c_str(), &st) == 0) {
+		if (!isPrivate(object, S_IFREG))
+			throw Unsupported{};
+		return;
+	}
+
+	// Build under a temporary name and rename, so that concurrent processes
+	// never load a partially written object.
+	std::string base = object + "." + std::to_string(getpid());
+	std::string sourcePath = base + ".cpp", tempObject = base + ".so";
+	{
+		std::ofstream file(sourcePath);
+		file << source;
+		if (!file)
+			throw Unsupported{};
+	}
+
+	int status = std::system((command + " -o " + shellQuote(tempObject) + ' '
+		+ shellQuote(sourcePath) + " >/dev/null 2>&1").c_str());
+	std::remove(sourcePath.c_str());
+	if (status != 0 || chmod(tempObject.c_str(), 0600) != 0
+			|| std::rename(tempObject.c_str(), object.c_str()) != 0) {
+		std::remove(tempObject.c_str());
+		throw Unsupported{};
+	}
+}
+
+NativeEvaluator::NativeEvaluator(const Puzzle &puzzle, std::string cacheDir)
+	: Evaluator(puzzle)
+{
+	std::string source = generate(puzzle);
+
+	if (cacheDir.empty())
+		cacheDir = defaultCacheDir();
+	// Anyone who can write to the directory could plant objects.
+	mkdir(cacheDir.c_str(), 0700);
+	if (!isPrivate(cacheDir, S_IFDIR))
+		throw Unsupported{};
+
+	// Objects from another compiler or other flags are not reused.
+	std::string command = compilerCommand();
+	char hash[17];
+	std::snprintf(hash, sizeof(hash), "%016zx",
+	              std::hash<std::string>()(command + '\n' + source));
+	std::string object = cacheDir + "/puzzle-" + hash + ".so";
+	compile(command, source, object);
+
+	handle = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+		throw Unsupported{};
+	check = reinterpret_cast<CheckFn>(dlsym(handle, "puzzle_check"));
+	enumerateFn = reinterpret_cast<EnumerateFn>(
+		dlsym(handle, "puzzle_enumerate"));
+	if (!check || !enumerateFn) {
+		dlclose(handle);
+		throw Unsupported{};
+	}
+}
+
+NativeEvaluator::~NativeEvaluator()
+{
+	dlclose(handle);
+}
+
+bool NativeEvaluator::operator()(const int *assignment) const
+{
+	return check(assignment);
+}
+
+namespace {
+
+/// What the generated code passes back to the callbacks.
+struct Callbacks {
+	const Visitor &visit;
+	const Monitor &monitor;
+	double total;
+};
+
+} // anonymous namespace
+
+static int visitTrampoline(void *ctx, const int *assignment)
+{
+	return static_cast<const Callbacks *>(ctx)->visit(assignment);
+}
+
+static int pollTrampoline(void *ctx, unsigned long long explored)
+{
+	const Callbacks *callbacks = static_cast<const Callbacks *>(ctx);
+	return !callbacks->monitor
+		|| callbacks->monitor(explored, explored / callbacks->total);
+}
+
+int NativeEvaluator::enumerate(const Visitor &visit,
+                               const Monitor &monitor) const
+{
+	if (puzzle.getNumLetters() > puzzle.getRadix())
+		throw std::domain_error("There are no injective maps if the codomain "
+		                        "is smaller than the domain.");
+	Callbacks callbacks{visit, monitor,
+		MapGen::count(puzzle.getNumLetters(), puzzle.getRadix())};
+	unsigned long long explored = 0;
+	int numSolutions = enumerateFn(visitTrampoline, pollTrampoline,
+	                               &callbacks, &explored);
+	if (monitor)
+		monitor(explored, explored / callbacks.total);
+	return numSolutions;
+}
+
+// END Implementation of NativeEvaluator
+
+} // namespace puzzle
@@ -0,0 +1,49 @@
+#ifndef PUZZLE_NATIVE
+#define PUZZLE_NATIVE
+
+#include "puzzle.hpp"
+#include <string>
+
+namespace puzzle {
+
+/**
+ * Evaluator running native code generated for the puzzle.
+ *
+ * C++ source with constants, coefficients and word layouts inlined is
+ * compiled with the system compiler ($CXX, or c++) into a shared object,
+ * which is cached by the hash of the compiler command and source and loaded
+ * with dlopen. The cache directory and objects are only used if they belong
+ * to the current user and nobody else can write to them. Throws
+ * Unsupported if no compiler is available or compilation fails, so that
+ * callers can fall back to the built-in evaluators.
+ */
+class NativeEvaluator : public Evaluator {
+public:
+	/// Objects are cached in @p cacheDir, or in $PUZZLE_NATIVE_CACHE or a
+	/// directory in $XDG_CACHE_HOME (by default ~/.cache) if that is empty.
+	NativeEvaluator(const Puzzle &puzzle, std::string cacheDir = {});
+	NativeEvaluator(const NativeEvaluator &) = delete;
+	NativeEvaluator &operator=(const NativeEvaluator &) = delete;
+	~NativeEvaluator();
+
+	bool operator()(const int *assignment) const override;
+	int enumerate(const Visitor &visit,
+	              const Monitor &monitor = {}) const override;
+
+	/// Generate the source for @p puzzle, or throw Unsupported.
+	static std::string generate(const Puzzle &puzzle);
+
+private:
+	using CheckFn = int (*)(const int *assignment);
+	using EnumerateFn = int (*)(int (*visit)(void *, const int *),
+	                            int (*poll)(void *, unsigned long long),
+	                            void *ctx, unsigned long long *explored);
+
+	void *handle;
+	CheckFn check;
+	EnumerateFn enumerateFn;
+};
+
+} // namespace puzzle
+
+#endif
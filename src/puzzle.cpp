@@ -1,5 +1,8 @@
 #include "puzzle.hpp"
+#include "analysis.hpp"
+#include "cache.hpp"
 #include "util.hpp"
+#include <algorithm>
 #include <cassert>
 #include <utility>
 #include <iterator>
@@ -7,6 +10,7 @@
 #include <limits>
 #include <cstring>
 #include <stdexcept>
+#include <vector>
 
 namespace puzzle {
 
@@ -38,12 +42,12 @@ static constexpr ExprType ParseTable[] = {
 	{'/', NodeType::DIVIDE, 2}
 };
 
-Expr *ExpressionParser::parse(const char *expr)
+const Expr *ExpressionParser::parse(const char *expr)
 {
 	return parse(expr, expr + strlen(expr));
 }
 
-Expr *ExpressionParser::parse(const char *begin, const char *end)
+const Expr *ExpressionParser::parse(const char *begin, const char *end)
 {
 	NodeType type = NodeType::LEAF;
 	const char *split;
@@ -67,15 +71,15 @@ Expr *ExpressionParser::parse(const char *begin, const char *end)
 			using enum BinaryExpr::Op;
 
 			case NodeType::EQUAL:
-				return EqualityExpr::create(arena, left, right);
+				return builder.equality(left, right);
 			case NodeType::PLUS:
-				return BinaryExpr::create(arena, Add, left, right);
+				return builder.binary(Add, left, right);
 			case NodeType::MINUS:
-				return BinaryExpr::create(arena, Sub, left, right);
+				return builder.binary(Sub, left, right);
 			case NodeType::MULTIPLY:
-				return BinaryExpr::create(arena, Mul, left, right);
+				return builder.binary(Mul, left, right);
 			case NodeType::DIVIDE:
-				return BinaryExpr::create(arena, Div, left, right);
+				return builder.binary(Div, left, right);
 			case NodeType::LEAF:
 				PUZZLE_UNREACHABLE;
 		}
@@ -94,24 +98,43 @@ Expr *ExpressionParser::parse(const char *begin, const char *end)
 			Letter word[WordExpr::maxSize];
 			for (size_t i = 0; i < len; ++i)
 				word[i] = letterToIndex.at(begin[(len-1) - i]);
-			return WordExpr::create(arena, word, len);
+			return builder.word(word, len);
 		} else {
-			int value = 0;
-			for (const char *cur = begin; cur != end; ++cur) {
-				value *= radix;
-				value += *cur - '0';
+			while (begin != end && *begin == '0')
+				++begin;
+			unsigned char digits[NumberExpr::maxDigits];
+			unsigned numDigits = 0;
+			for (const char *cur = end; cur != begin;) {
+				if (numDigits == NumberExpr::maxDigits)
+					throw std::out_of_range("Number too large");
+				digits[numDigits++] = *--cur - '0';
 			}
-			return NumberExpr::create(arena, value);
+			int value = literalValue(digits, numDigits, radix);
+			// Single digits mean the same in every radix.
+			if (numDigits <= 1)
+				return builder.number(value);
+			return builder.literal(digits, numDigits, value);
 		}
 	}
 }
 
+int ExpressionParser::literalValue(const unsigned char *digits,
+                                   unsigned numDigits, int radix)
+{
+	int value = 0;
+	for (unsigned i = numDigits; i--;)
+		if (__builtin_mul_overflow(value, radix, &value)
+				|| __builtin_add_overflow(value, digits[i], &value))
+			throw std::out_of_range("Number too large");
+	return value;
+}
+
 // END Implementation of ExpressionParser
 
 // BEGIN Implementation of Puzzle
 
 Puzzle::Puzzle(const char *puzzle, int rad)
-	: radix(rad), numLetters(0)
+	: radix(rad), numLetters(0), arena(std::make_shared<Arena>())
 {
 	// Collect letters.
 	std::map<char, Letter> letterToIndex;
@@ -126,9 +149,21 @@ Puzzle::Puzzle(const char *puzzle, int rad)
 		pair.second = numLetters++;
 	}
 
-	// Make syntax tree.
-	ExpressionParser parser(arena, letterToIndex, rad);
-	root = parser.parse(puzzle);
+	// Make syntax trees, one per equation. They share identical subtrees.
+	ExpressionParser parser(*arena, letterToIndex, rad);
+	for (const char *begin = puzzle;;) {
+		const char *end = std::strchr(begin, ',');
+		if (!end)
+			end = begin + std::strlen(begin);
+		if (begin == end)
+			throw std::invalid_argument("Equation "
+				+ std::to_string(roots.size() + 1) + " is empty");
+		roots.push_back(parser.parse(begin, end));
+		literals = literals || dependsOnRadix(roots.back());
+		if (!*end)
+			break;
+		begin = end + 1;
+	}
 
 	// Leading digits aren't allowed to be zero.
 	if (puzzle[0] >= 'A' && puzzle[0] <= 'Z')
@@ -138,6 +173,79 @@ Puzzle::Puzzle(const char *puzzle, int rad)
 			leading[letterToIndex[puzzle[i]]] = true;
 }
 
+Puzzle::Puzzle(std::span<const char> letters, LetterSet leading, int rad)
+	: radix(rad), numLetters(letters.size()), leading(leading)
+{
+	assert(letters.size() <= maxNumLetters);
+	std::copy(letters.begin(), letters.end(), indexToLetter);
+}
+
+Puzzle::Puzzle(const Puzzle &puzzle, int rad)
+	: radix(rad), numLetters(puzzle.numLetters), leading(puzzle.leading),
+	  literals(puzzle.literals), arena(puzzle.arena), roots(puzzle.roots)
+{
+	std::copy_n(puzzle.indexToLetter, numLetters, indexToLetter);
+	if (!literals)
+		return;
+
+	// Literals have another value, so rebuild the trees around them.
+	arena = std::make_shared<Arena>();
+	ExprBuilder builder(*arena);
+	for (const Expr *&root : roots)
+		root = rebuild(builder, root, rad);
+}
+
+bool Puzzle::dependsOnRadix(const Expr *expr)
+{
+	switch (expr->getKind()) {
+	case Expr::Kind::Number:
+		return cast<NumberExpr>(expr)->dependsOnRadix();
+	case Expr::Kind::Word:
+		return false;
+	case Expr::Kind::Equality: {
+		const EqualityExpr *eqExpr = cast<EqualityExpr>(expr);
+		return dependsOnRadix(eqExpr->getLeft())
+			|| dependsOnRadix(eqExpr->getRight());
+	}
+	case Expr::Kind::Binary: {
+		const BinaryExpr *binExpr = cast<BinaryExpr>(expr);
+		return dependsOnRadix(binExpr->getLeft())
+			|| dependsOnRadix(binExpr->getRight());
+	}
+	}
+	PUZZLE_UNREACHABLE;
+}
+
+const Expr *Puzzle::rebuild(ExprBuilder &builder, const Expr *expr, int rad)
+{
+	switch (expr->getKind()) {
+	case Expr::Kind::Number: {
+		const NumberExpr *numExpr = cast<NumberExpr>(expr);
+		std::span<const unsigned char> digits = numExpr->getDigits();
+		if (digits.empty())
+			return builder.number(numExpr->getValue());
+		return builder.literal(digits.data(), digits.size(),
+			ExpressionParser::literalValue(digits.data(), digits.size(), rad));
+	}
+	case Expr::Kind::Word: {
+		std::span<const Letter> word = cast<WordExpr>(expr)->getWord();
+		return builder.word(word.data(), word.size());
+	}
+	case Expr::Kind::Equality: {
+		const EqualityExpr *eqExpr = cast<EqualityExpr>(expr);
+		return builder.equality(rebuild(builder, eqExpr->getLeft(), rad),
+		                        rebuild(builder, eqExpr->getRight(), rad));
+	}
+	case Expr::Kind::Binary: {
+		const BinaryExpr *binExpr = cast<BinaryExpr>(expr);
+		return builder.binary(binExpr->getOp(),
+		                      rebuild(builder, binExpr->getLeft(), rad),
+		                      rebuild(builder, binExpr->getRight(), rad));
+	}
+	}
+	PUZZLE_UNREACHABLE;
+}
+
 // END Implementation of Puzzle
 
 // BEGIN Implementation of Permutation generator
@@ -211,45 +319,360 @@ bool MapGen::nextMap()
 	return true;
 }
 
+double MapGen::count(int domainSize, int codomainSize)
+{
+	double count = 1;
+	for (int i = 0; i < domainSize; ++i)
+		count *= codomainSize - i;
+	return count;
+}
+
 // END Implementation of Permutation generator
 
-// BEGIN Implementation of Puzzle solver
+// BEGIN Implementation of Evaluator
 
-PuzzleSolver::PuzzleSolver(const Puzzle &puzzle, const Evaluator& eval)
-	: puzzle(puzzle), eval(eval) {}
+namespace {
 
-int PuzzleSolver::print_solutions(std::ostream &out, bool terminal)
-{
+/**
+ * Backtracking search for puzzles consisting of several constraints.
+ * Letters are assigned in an order that completes constraints as early as
+ * possible, and each constraint is checked as soon as all of its letters
+ * have been assigned, pruning everything below.
+ */
+class ConstraintSearch {
+public:
+	ConstraintSearch(const Puzzle &puzzle, const Evaluator &eval,
+	                 const Visitor &visit, const Analysis *analysis,
+	                 const Monitor &monitor);
+	int run();
+
+private:
+	void addToOrder(Puzzle::LetterSet letters);
+	bool search(int depth);
+	double estimateProgress(int depth) const;
+
+	const Puzzle &puzzle;
+	const Evaluator &eval;
+	const Visitor &visit;
+	const Analysis *analysis;
+	const Monitor &monitor;
+	uint64_t explored = 0;
+	unsigned untilPoll = monitorInterval;
+	/// Depth of the last assignment.
+	int current = 0;
+	/// Order in which letters are assigned.
+	std::vector<int> order;
+	/// Constraints that can be checked after assigning order[depth].
+	std::vector<std::vector<int>> checks;
+	/// Constraints that don't depend on any letter.
+	std::vector<int> constant;
+	std::vector<char> used;
+	int assignment[Puzzle::maxNumLetters] = {};
 	int numSolutions = 0;
+};
 
-	try {
-		MapGen mapGen(puzzle.getNumLetters(), puzzle.getRadix());
+ConstraintSearch::ConstraintSearch(const Puzzle &puzzle, const Evaluator &eval,
+                                   const Visitor &visit,
+                                   const Analysis *analysis,
+                                   const Monitor &monitor)
+	: puzzle(puzzle), eval(eval), visit(visit), analysis(analysis),
+	  monitor(monitor), checks(puzzle.getNumLetters()),
+	  used(puzzle.getRadix())
+{
+	int numLetters = puzzle.getNumLetters();
+	int numConstraints = eval.getNumConstraints();
+	Puzzle::LetterSet all;
+	for (int i = 0; i < numLetters; ++i)
+		all[i] = true;
+
+	// Greedily take the constraint with the fewest letters not yet ordered.
+	Puzzle::LetterSet ordered;
+	std::vector<bool> done(numConstraints);
+	for (;;) {
+		int best = -1;
+		size_t bestNew = 0, bestTotal = 0;
+		for (int c = 0; c < numConstraints; ++c) {
+			if (done[c])
+				continue;
+			Puzzle::LetterSet letters = eval.getConstraintLetters(c) & all;
+			size_t numNew = (letters & ~ordered).count();
+			if (best < 0 || numNew < bestNew
+					|| (numNew == bestNew && letters.count() < bestTotal)) {
+				best = c;
+				bestNew = numNew;
+				bestTotal = letters.count();
+			}
+		}
+		if (best < 0)
+			break;
+		done[best] = true;
+		Puzzle::LetterSet letters = eval.getConstraintLetters(best) & all;
+		addToOrder(letters & ~ordered);
+		ordered |= letters;
+	}
+	addToOrder(all & ~ordered);
+
+	// Check each constraint once its last letter has been assigned.
+	std::vector<int> position(numLetters);
+	for (int depth = 0; depth < numLetters; ++depth)
+		position[order[depth]] = depth;
+	for (int c = 0; c < numConstraints; ++c) {
+		Puzzle::LetterSet letters = eval.getConstraintLetters(c) & all;
+		int last = -1;
+		for (int i = 0; i < numLetters; ++i)
+			if (letters[i])
+				last = std::max(last, position[i]);
+		if (last < 0)
+			constant.push_back(c);
+		else
+			checks[last].push_back(c);
+	}
+}
 
-		out << '\n';
-		if (terminal)
-			out << "\e[1m";
-		for (int i = 0; i < puzzle.getNumLetters(); ++i)
-			out << puzzle[i] << ' ';
-		if (terminal)
-			out << "\e[0m";
-		out << std::endl;
+/// Append @p letters to the order, those with the fewest digits first.
+void ConstraintSearch::addToOrder(Puzzle::LetterSet letters)
+{
+	size_t begin = order.size();
+	for (int i = 0; i < puzzle.getNumLetters(); ++i)
+		if (letters[i])
+			order.push_back(i);
+	if (analysis)
+		std::stable_sort(order.begin() + begin, order.end(),
+			[this](int a, int b) {
+				return analysis->getDomainSize(a)
+					< analysis->getDomainSize(b);
+			});
+}
+
+int ConstraintSearch::run()
+{
+	for (int c : constant)
+		if (!eval.checkConstraint(c, assignment))
+			return 0;
+	bool complete = search(0);
+	if (monitor)
+		monitor(explored, complete ? 1 : estimateProgress(current));
+	return numSolutions;
+}
+
+/**
+ * Position of the search as fraction of the tree, taking the digits of each
+ * letter as equally expensive. The deepest assignment is still in progress.
+ */
+double ConstraintSearch::estimateProgress(int depth) const
+{
+	double progress = 0, share = 1;
+	for (int d = 0; d <= depth && d < puzzle.getNumLetters(); ++d) {
+		int letter = order[d];
+		int first = puzzle.getLeading()[letter] ? 1 : 0;
+		share /= puzzle.getRadix() - first;
+		progress += share * (assignment[letter] - first);
+	}
+	return progress;
+}
+
+/// Returns false if the visitor or monitor asked to stop.
+bool ConstraintSearch::search(int depth)
+{
+	if (depth == puzzle.getNumLetters()) {
+		++numSolutions;
+		return visit(assignment);
+	}
+
+	int letter = order[depth];
+	bool leading = puzzle.getLeading()[letter];
+	for (int digit = leading ? 1 : 0; digit < puzzle.getRadix(); ++digit) {
+		if (used[digit] || (analysis && !analysis->allows(letter, digit)))
+			continue;
+		assignment[letter] = digit;
+		current = depth;
+
+		++explored;
+		if (!--untilPoll) {
+			untilPoll = monitorInterval;
+			if (monitor && !monitor(explored, estimateProgress(depth)))
+				return false;
+		}
 
-		do
-			if (eval(*mapGen)) {
-				++numSolutions;
-				for (int i = 0; i < puzzle.getNumLetters(); ++i)
-					out << mapGen[i] << ' ';
-				out << std::endl;
+		bool valid = true;
+		for (int c : checks[depth])
+			if (!eval.checkConstraint(c, assignment)) {
+				valid = false;
+				break;
 			}
-		while (mapGen.nextMap());
+		if (!valid)
+			continue;
+
+		used[digit] = true;
+		bool proceed = search(depth + 1);
+		used[digit] = false;
+		if (!proceed)
+			return false;
 	}
-	catch (const std::domain_error &) {
-		out << "This alphametic has too many letters.\n\n";
+	return true;
+}
+
+} // anonymous namespace
+
+int Evaluator::enumerate(const Visitor &visit, const Monitor &monitor) const
+{
+	if (getNumConstraints() > 1)
+		return search(visit, nullptr, monitor);
+
+	MapGen mapGen(puzzle.getNumLetters(), puzzle.getRadix());
+	double total = MapGen::count(puzzle.getNumLetters(), puzzle.getRadix());
+	int numSolutions = 0;
+	uint64_t explored = 0;
+	unsigned untilPoll = monitorInterval;
+
+	do {
+		++explored;
+		if ((*this)(*mapGen)) {
+			++numSolutions;
+			if (!visit(*mapGen))
+				break;
+		}
+		if (!--untilPoll) {
+			untilPoll = monitorInterval;
+			if (monitor && !monitor(explored, explored / total))
+				break;
+		}
+	} while (mapGen.nextMap());
+
+	if (monitor)
+		monitor(explored, explored / total);
+	return numSolutions;
+}
+
+int Evaluator::search(const Visitor &visit, const Analysis *analysis,
+                      const Monitor &monitor) const
+{
+	if (puzzle.getNumLetters() > puzzle.getRadix())
+		throw std::domain_error("There are no injective maps if the "
+		                        "codomain is smaller than the domain.");
+	return ConstraintSearch(puzzle, *this, visit, analysis, monitor).run();
+}
+
+// END Implementation of Evaluator
+
+// BEGIN Implementation of Puzzle solver
+
+PuzzleSolver::PuzzleSolver(const Puzzle &puzzle, const Evaluator& eval,
+                           ResultCache *cache)
+	: puzzle(puzzle), eval(eval), cache(cache) {}
+
+/**
+ * Visit all solutions until the visitor or @p monitor returns false, see
+ * Evaluator::enumerate and Evaluator::search. Complete results are
+ * stored in the cache, if there is one, and later runs are answered from it
+ * without enumerating again. Puzzles that the static analysis finds
+ * infeasible aren't searched at all.
+ *
+ * @return Number of solutions visited.
+ */
+int PuzzleSolver::solve(const Visitor &visit, const Monitor &monitor)
+{
+	int numSolutions;
+	if (replay(visit, numSolutions))
+		return numSolutions;
+	return solve(visit, monitor, analyze());
+}
+
+/// Visit the cached solutions, if there are any. Returns whether there were.
+bool PuzzleSolver::replay(const Visitor &visit, int &numSolutions)
+{
+	if (!cache)
+		return false;
+	auto solutions = cache->lookup(puzzle);
+	if (!solutions)
+		return false;
+	numSolutions = 0;
+	for (const std::vector<int> &solution : *solutions) {
+		++numSolutions;
+		if (!visit(solution.data()))
+			break;
 	}
+	return true;
+}
 
+Analysis PuzzleSolver::analyze() const
+{
+	return Analysis(puzzle, dynamic_cast<const LinearEvaluator *>(&eval));
+}
+
+int PuzzleSolver::solve(const Visitor &visit, const Monitor &monitor,
+                        const Analysis &analysis)
+{
+	if (analysis.isInfeasible())
+		return 0;
+
+	std::vector<std::vector<int>> solutions;
+	bool complete = true;
+	Monitor watch;
+	if (monitor)
+		watch = [&](uint64_t explored, double progress) {
+			if (monitor(explored, progress))
+				return true;
+			complete = false;
+			return false;
+		};
+	Visitor collect = [&](const int *assignment) {
+		if (cache)
+			solutions.emplace_back(assignment,
+			                       assignment + puzzle.getNumLetters());
+		if (!visit(assignment)) {
+			complete = false;
+			return false;
+		}
+		return true;
+	};
+
+	// Searching is slower per assignment than enumerating, so it only pays
+	// off if the analysis has excluded enough digits.
+	static constexpr double minReduction = 1.0 / 16;
+	int numSolutions;
+	if (eval.getNumConstraints() > 1 || analysis.getReduction() < minReduction)
+		numSolutions = eval.search(collect, &analysis, watch);
+	else
+		numSolutions = eval.enumerate(collect, watch);
+
+	if (cache && complete)
+		cache->store(puzzle, solutions);
 	return numSolutions;
 }
 
+int PuzzleSolver::print_solutions(std::ostream &out, bool terminal)
+{
+	if (puzzle.getNumLetters() > puzzle.getRadix()) {
+		out << "This alphametic has too many letters.\n\n";
+		return 0;
+	}
+
+	out << '\n';
+	if (terminal)
+		out << "\e[1m";
+	for (int i = 0; i < puzzle.getNumLetters(); ++i)
+		out << puzzle[i] << ' ';
+	if (terminal)
+		out << "\e[0m";
+	out << std::endl;
+
+	Visitor print = [&](const int *assignment) {
+		for (int i = 0; i < puzzle.getNumLetters(); ++i)
+			out << assignment[i] << ' ';
+		out << std::endl;
+		return true;
+	};
+	int numSolutions;
+	if (replay(print, numSolutions))
+		return numSolutions;
+
+	Analysis analysis = analyze();
+	if (analysis.isInfeasible())
+		out << "No solution, " << analysis.getReason() << ".\n";
+	return solve(print, {}, analysis);
+}
+
 // END Implementation of Puzzle solver.
 
 }
@@ -2,14 +2,18 @@
 #define PUZZLE_HPP
 
 #include "arena.hpp"
+#include "compact.hpp"
 #include "expr.hpp"
 #include "fraction.hpp"
+#include "kernel.hpp"
 #include <bitset>
 #include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
 #include <ostream>
 #include <span>
+#include <vector>
 
 namespace puzzle {
 	class ExpressionParser
@@ -17,71 +21,234 @@ namespace puzzle {
 	public:
 		ExpressionParser(
 			Arena &arena, const std::map<char, Letter> &letterToIndex, int radix)
-			: arena(arena), letterToIndex(letterToIndex), radix(radix) {}
-		Expr *parse(const char *expr);
+			: builder(arena), letterToIndex(letterToIndex), radix(radix) {}
+		const Expr *parse(const char *expr);
+		const Expr *parse(const char *begin, const char *end);
+
+		/// Value of @p digits, least significant first, in @p radix. Throws
+		/// std::out_of_range if it doesn't fit into an int.
+		static int literalValue(const unsigned char *digits,
+		                        unsigned numDigits, int radix);
 
 	private:
-		Expr *parse(const char *begin, const char *end);
 
-		Arena &arena;
+		ExprBuilder builder;
 		const std::map<char, Letter> &letterToIndex;
 		int radix;
 	};
 
 	/**
 	 * Puzzle data structure
+	 *
+	 * A puzzle consists of one or more comma-separated equations over the
+	 * same letters.
 	 */
 	class Puzzle {
 	public:
 		static constexpr int maxNumLetters = 32;
+		using LetterSet = std::bitset<maxNumLetters>;
 
 		Puzzle(const char *puzzle, int rad);
+		/// Puzzle over @p letters, in the order of their indices, without
+		/// syntax trees. Its equations have to be given as rows of a
+		/// LinearForm, so only a LinearEvaluator can be set up for it.
+		Puzzle(std::span<const char> letters, LetterSet leading, int rad);
+		/// The same puzzle in another radix. The syntax trees are shared,
+		/// unless there are literals with more than one digit, whose value
+		/// depends on the radix. Then the trees are rebuilt without parsing.
+		Puzzle(const Puzzle &puzzle, int rad);
 		int getRadix() const { return radix; }
 		int getNumLetters() const { return numLetters; }
-		std::bitset<maxNumLetters> getLeading() const { return leading; }
+		LetterSet getLeading() const { return leading; }
 		char operator[](int n) const { return indexToLetter[n]; }
-		const Expr *getRoot() const { return root; }
+		std::span<const Expr *const> getRoots() const { return roots; }
 
 	private:
+		static bool dependsOnRadix(const Expr *expr);
+		static const Expr *rebuild(ExprBuilder &builder, const Expr *expr,
+		                           int rad);
+
 		int radix;
 		int numLetters;
 		char indexToLetter[maxNumLetters];
-		std::bitset<maxNumLetters> leading;
-		Arena arena;
-		const Expr *root;
+		LetterSet leading;
+		/// Whether some literal's value depends on the radix.
+		bool literals = false;
+		/// Shared by puzzles for other radices.
+		std::shared_ptr<Arena> arena;
+		std::vector<const Expr *> roots;
 	};
 
 	/// Exception to be thrown when a strategy does not support the puzzle.
 	struct Unsupported {};
 
+	class Analysis;
+
 	class Evaluator {
 	public:
+		/// The puzzle has to outlive the evaluator.
+		explicit Evaluator(const Puzzle &puzzle) : puzzle(puzzle) {}
 		virtual ~Evaluator() = default;
 		virtual bool operator()(const int *assignment) const = 0;
+
+		const Puzzle &getPuzzle() const { return puzzle; }
+
+		/// Visit all solutions of the puzzle the evaluator was created for,
+		/// until the visitor or @p monitor returns false. Returns the number
+		/// visited.
+		virtual int enumerate(const Visitor &visit,
+		                      const Monitor &monitor = {}) const;
+
+		/// Visit all solutions by backtracking over the constraints, trying
+		/// only the digits that @p analysis allows, if given.
+		int search(const Visitor &visit, const Analysis *analysis = nullptr,
+		           const Monitor &monitor = {}) const;
+
+		/// The puzzle without the leading digit condition as conjunction of
+		/// constraints, each depending only on some letters. By default there
+		/// is just operator(), depending on all letters.
+		virtual int getNumConstraints() const { return 1; }
+		virtual Puzzle::LetterSet getConstraintLetters(int) const
+		{
+			return Puzzle::LetterSet().set();
+		}
+		virtual bool checkConstraint(int, const int *assignment) const
+		{
+			return (*this)(assignment);
+		}
+
+	protected:
+		const Puzzle &puzzle;
+	};
+
+	/// Integer width that is provably sufficient for an evaluation.
+	enum class Width {
+		Int32,
+		Int64,
+		Int128,
+		/// No width is provably sufficient, check for overflow.
+		Checked,
 	};
 
 	class GenericEvaluator : public Evaluator {
 	public:
-		GenericEvaluator(const Puzzle &puzzle) : puzzle(puzzle) {}
+		GenericEvaluator(const Puzzle &puzzle);
 
 		bool operator()(const int *assignment) const override;
+		int getNumConstraints() const override { return equations.size(); }
+		Puzzle::LetterSet getConstraintLetters(int equation) const override
+		{
+			return equations[equation].letters;
+		}
+		bool checkConstraint(int equation,
+		                     const int *assignment) const override;
+		Width getWidth() const { return width; }
 
 	private:
-		const Puzzle &puzzle;
+		struct Equation {
+			CompactAst::Ref root;
+			Puzzle::LetterSet letters;
+		};
+
+		/// Copy of the syntax trees with better locality for evaluation.
+		CompactAst ast;
+		/// Ordered by number of letters, so that cheap ones come first.
+		std::vector<Equation> equations;
+		Width width;
+	};
+
+	/**
+	 * The equations of a linear puzzle as rows constant + Σ coeff·letter = 0,
+	 * with coefficients and constant as polynomials in the radix. Literals
+	 * contribute their digits, so the form is valid for every radix and
+	 * evaluators for many radices can be set up without walking the syntax
+	 * trees again. Throws Unsupported for nonlinear puzzles.
+	 */
+	class LinearForm {
+	public:
+		/// Σ coeff[k]·radixᵏ
+		struct Polynomial {
+			/// Enough for a word times a literal.
+			static constexpr unsigned size =
+				WordExpr::maxSize + NumberExpr::maxDigits;
+			__int128 coeff[size];
+
+			/// Throws Unsupported if the value doesn't fit into 128 bits.
+			__int128 operator()(int radix) const;
+			/// Add @p other·radix^shift, throws Unsupported on overflow.
+			void add(const Polynomial &other, unsigned shift = 0);
+		};
+
+		struct Row {
+			Polynomial coeff[Puzzle::maxNumLetters];
+			Polynomial constant;
+		};
+
+		explicit LinearForm(const Puzzle &puzzle);
+		const std::vector<Row> &getRows() const { return rows; }
+
+	private:
+		void add(Row &row, const Expr *expr, const Polynomial &factor);
+
+		std::vector<Row> rows;
 	};
 
 	class LinearEvaluator : public Evaluator {
 	public:
 		LinearEvaluator(const Puzzle &puzzle);
+		/// Instantiate @p form, which was made for the same equations, in
+		/// the radix of @p puzzle.
+		LinearEvaluator(const Puzzle &puzzle, const LinearForm &form);
+		LinearEvaluator(const Puzzle &puzzle,
+		                std::span<const LinearForm::Row> form);
+
+		/// Set up the rows of @p form again, e.g. after the puzzle has
+		/// been assigned another one over different letters. Reuses the
+		/// allocations of the previous rows.
+		void reset(std::span<const LinearForm::Row> form);
 
 		bool operator()(const int *assignment) const override;
+		int enumerate(const Visitor &visit,
+		              const Monitor &monitor = {}) const override;
+		int getNumConstraints() const override { return wide.size(); }
+		Puzzle::LetterSet getConstraintLetters(int row) const override;
+		bool checkConstraint(int row, const int *assignment) const override;
+		Width getWidth() const { return width; }
+
+		/// Rows are equations of the form constant + Σ coeff·letter = 0.
+		/// Besides the equations of the puzzle, there are rows derived by
+		/// eliminating letters between them.
+		int getNumRows() const { return wide.size(); }
+		__int128 getCoeff(int row, int letter) const
+		{
+			return wide[row].coeff[letter];
+		}
+		__int128 getConstant(int row) const { return wide[row].constant; }
 
 	private:
-		void addCoeff(const Expr* expr, int factor);
+		template<typename T>
+		struct Coefficients {
+			T coeff[Puzzle::maxNumLetters];
+			T constant;
+		};
 
-		const Puzzle& puzzle;
-		int coeff[Puzzle::maxNumLetters];
-		int constant;
+		void deriveRows();
+		template<typename T>
+		bool evaluate(const Coefficients<T> &coeffs,
+		              const int *assignment) const;
+		template<typename T>
+		bool evaluate(const std::vector<Coefficients<T>> &rows,
+		              const int *assignment) const;
+
+		/// Ordered by number of letters, so that cheap rows come first.
+		std::vector<Coefficients<__int128>> wide;
+		/// Narrowest type that can hold every partial sum.
+		Width width;
+		std::vector<Coefficients<int32_t>> rows32;
+		std::vector<Coefficients<int64_t>> rows64;
+		/// Specialized kernels for the letter count and radix, if any.
+		LinearKernel<int32_t> kernel32 = nullptr;
+		LinearKernel<int64_t> kernel64 = nullptr;
 	};
 
 	/**
@@ -95,23 +262,38 @@ namespace puzzle {
 		int *operator *() const { return map.get(); }
 		bool nextMap();
 
+		/// Number of injective maps, in floating point as it can be huge.
+		static double count(int domainSize, int codomainSize);
+
 	private:
 		int n;      ///< Codomain size
 		int m;      ///< Domain size
 		std::unique_ptr<int[]> map;
 	};
 
+	class ResultCache;
+
 	/**
 	 * Puzzle solver
 	 */
 	class PuzzleSolver {
 	public:
-		PuzzleSolver(const Puzzle &puzz, const Evaluator& eval);
+		using Visitor = puzzle::Visitor;
+
+		PuzzleSolver(const Puzzle &puzz, const Evaluator& eval,
+		             ResultCache *cache = nullptr);
+		int solve(const Visitor &visit, const Monitor &monitor = {});
 		int print_solutions(std::ostream& out, bool terminal);
 
 	private:
+		bool replay(const Visitor &visit, int &numSolutions);
+		Analysis analyze() const;
+		int solve(const Visitor &visit, const Monitor &monitor,
+		          const Analysis &analysis);
+
 		const Puzzle &puzzle;
 		const Evaluator &eval;
+		ResultCache *cache;
 	};
 }
 
@@ -0,0 +1,457 @@
+#include "server.hpp"
+#include "async.hpp"
+#include "cache.hpp"
+#include "native.hpp"
+#include "puzzle.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+
+namespace puzzle {
+
+using Clock = std::chrono::steady_clock;
+
+/// How often a waiting connection checks whether its client hung up.
+static constexpr auto hangupInterval = std::chrono::milliseconds(50);
+
+/// Write all of @p line, returns false if the client is gone.
+static bool writeLine(int fd, const std::string &line)
+{
+	const char *data = line.data();
+	size_t remaining = line.size();
+	while (remaining) {
+		ssize_t written = send(fd, data, remaining, MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += written;
+		remaining -= written;
+	}
+	return true;
+}
+
+/// Read the next line without terminator, returns false at end of input.
+static bool readLine(int fd, std::string &buffer, std::string &line)
+{
+	size_t newline;
+	while ((newline = buffer.find('\n')) == std::string::npos) {
+		char chunk[4096];
+		ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0)
+			return false;
+		buffer.append(chunk, received);
+	}
+	line.assign(buffer, 0, newline);
+	buffer.erase(0, newline + 1);
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+	return true;
+}
+
+static bool hungUp(int fd)
+{
+	pollfd pfd{fd, 0, 0};
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR));
+}
+
+/**
+ * Remove a socket file left behind at @p address by a server that is gone.
+ * Throws std::system_error if something else is there, or if a server is
+ * still listening on it.
+ */
+static void removeStaleSocket(const sockaddr_un &address)
+{
+	const char *path = address.sun_path;
+	struct stat status;
+	if (lstat(path, &status) < 0) {
+		if (errno == ENOENT)
+			return;
+		throw std::system_error(errno, std::generic_category(), path);
+	}
+	if (!S_ISSOCK(status.st_mode))
+		throw std::system_error(EEXIST, std::generic_category(), path);
+
+	int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (probe < 0)
+		throw std::system_error(errno, std::generic_category(), "socket");
+	int result = connect(probe, reinterpret_cast<const sockaddr *>(&address),
+	                     sizeof(address));
+	int error = result < 0 ? errno : EADDRINUSE;
+	close(probe);
+	if (error != ECONNREFUSED)
+		throw std::system_error(error, std::generic_category(), path);
+	if (unlink(path) < 0 && errno != ENOENT)
+		throw std::system_error(errno, std::generic_category(), path);
+}
+
+static std::unique_ptr<Evaluator> createEvaluator(const Puzzle &puzzle,
+                                                  bool native)
+{
+	if (native) {
+		try {
+			return std::make_unique<NativeEvaluator>(puzzle);
+		} catch (const Unsupported &) {}
+	}
+	try {
+		return std::make_unique<LinearEvaluator>(puzzle);
+	} catch (const Unsupported &) {
+		return std::make_unique<GenericEvaluator>(puzzle);
+	}
+}
+
+static const char *statusName(SolveResult::Status status)
+{
+	switch (status) {
+	case SolveResult::Status::Completed:
+		return "completed";
+	case SolveResult::Status::Cancelled:
+		return "cancelled";
+	case SolveResult::Status::TimedOut:
+		return "timeout";
+	case SolveResult::Status::Failed:
+		return "failed";
+	}
+	return "unknown";
+}
+
+static std::string solutionLine(const int *assignment, int numLetters)
+{
+	std::string line = "SOLUTION";
+	for (int i = 0; i < numLetters; ++i)
+		line += ' ' + std::to_string(assignment[i]);
+	return line + '\n';
+}
+
+// BEGIN Implementation of Server::Worker
+
+struct Server::Job {
+	int fd;
+	int radix;
+	std::string equation;
+	Clock::time_point deadline;
+
+	std::mutex mutex;
+	std::condition_variable finished;
+	/// The running solve, if any.
+	SolveTask *task = nullptr;
+	bool cancelled = false;
+	bool done = false;
+};
+
+/**
+ * State of a worker thread that is kept between requests.
+ */
+class Server::Worker {
+public:
+	explicit Worker(const ServerOptions &options) : options(options) {}
+
+	void run(Job &job);
+
+private:
+	struct Prepared {
+		std::unique_ptr<Puzzle> puzzle;
+		std::unique_ptr<Evaluator> eval;
+	};
+	using Entry = std::pair<std::string, Prepared>;
+
+	const Prepared &prepare(int radix, const std::string &equation);
+
+	const ServerOptions &options;
+	/// Most recently used first.
+	std::list<Entry> prepared;
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+const Server::Worker::Prepared &Server::Worker::prepare(
+	int radix, const std::string &equation)
+{
+	std::string key = std::to_string(radix) + ' ' + equation;
+	auto it = index.find(key);
+	if (it != index.end()) {
+		prepared.splice(prepared.begin(), prepared, it->second);
+		return it->second->second;
+	}
+
+	Prepared entry;
+	entry.puzzle = std::make_unique<Puzzle>(equation.c_str(), radix);
+	if (entry.puzzle->getNumLetters() > radix)
+		throw std::domain_error("Too many letters for the radix");
+	entry.eval = createEvaluator(*entry.puzzle, options.native);
+
+	if (prepared.size() >= options.maxPrepared && !prepared.empty()) {
+		index.erase(prepared.back().first);
+		prepared.pop_back();
+	}
+	prepared.emplace_front(key, std::move(entry));
+	index.emplace(std::move(key), prepared.begin());
+	return prepared.front().second;
+}
+
+void Server::Worker::run(Job &job)
+{
+	{
+		std::lock_guard<std::mutex> lock(job.mutex);
+		if (job.cancelled) {
+			writeLine(job.fd, "DONE 0 cancelled\n");
+			return;
+		}
+	}
+
+	try {
+		const Prepared &entry = prepare(job.radix, job.equation);
+		const Puzzle &puzzle = *entry.puzzle;
+		int numLetters = puzzle.getNumLetters();
+
+		std::string letters = "LETTERS";
+		for (int i = 0; i < numLetters; ++i)
+			(letters += ' ') += puzzle[i];
+		if (!writeLine(job.fd, letters + '\n'))
+			return;
+
+		if (options.cache) {
+			if (auto solutions = options.cache->lookup(puzzle)) {
+				for (const std::vector<int> &solution : *solutions)
+					if (!writeLine(job.fd, solutionLine(solution.data(),
+					                                    numLetters)))
+						return;
+				writeLine(job.fd, "DONE " + std::to_string(solutions->size())
+					+ " completed\n");
+				return;
+			}
+		}
+
+		SolveOptions solveOptions;
+		if (job.deadline != Clock::time_point::max()) {
+			solveOptions.timeLimit = job.deadline - Clock::now();
+			if (solveOptions.timeLimit <= Clock::duration::zero()) {
+				writeLine(job.fd, "DONE 0 timeout\n");
+				return;
+			}
+		}
+		solveOptions.onSolution = [&](const int *assignment) {
+			return writeLine(job.fd, solutionLine(assignment, numLetters));
+		};
+
+		SolveTask task(puzzle, *entry.eval, std::move(solveOptions));
+		{
+			std::lock_guard<std::mutex> lock(job.mutex);
+			job.task = &task;
+			if (job.cancelled)
+				task.cancel();
+		}
+		SolveResult result;
+		try {
+			result = task.run();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(job.mutex);
+			job.task = nullptr;
+			throw;
+		}
+		{
+			std::lock_guard<std::mutex> lock(job.mutex);
+			job.task = nullptr;
+		}
+
+		if (result.status == SolveResult::Status::Failed) {
+			writeLine(job.fd, "ERROR " + result.error + '\n');
+			return;
+		}
+		if (options.cache && result.status == SolveResult::Status::Completed)
+			options.cache->store(puzzle, result.solutions);
+		writeLine(job.fd, "DONE " + std::to_string(result.solutions.size())
+			+ ' ' + statusName(result.status) + '\n');
+	} catch (const std::exception &error) {
+		writeLine(job.fd, std::string("ERROR ") + error.what() + '\n');
+	}
+}
+
+// END Implementation of Server::Worker
+
+// BEGIN Implementation of Server
+
+Server::Server(const char *socketPath, ServerOptions options)
+	: path(socketPath), options(options)
+{
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		throw std::invalid_argument("Socket path too long");
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	removeStaleSocket(address);
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenFd < 0)
+		throw std::system_error(errno, std::generic_category(), "socket");
+
+	if (bind(listenFd, reinterpret_cast<const sockaddr *>(&address),
+	         sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+		int error = errno;
+		close(listenFd);
+		throw std::system_error(error, std::generic_category(), socketPath);
+	}
+
+	unsigned numWorkers = options.numWorkers;
+	if (!numWorkers)
+		numWorkers = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned i = 0; i < numWorkers; ++i)
+		workers.emplace_back(&Server::work, this);
+}
+
+Server::~Server()
+{
+	stop();
+	for (Connection &connection : connections)
+		connection.thread.join();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		draining = true;
+	}
+	queued.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+
+	close(listenFd);
+	unlink(path.c_str());
+}
+
+void Server::run()
+{
+	for (;;) {
+		int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (stopping.load())
+				return;
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			throw std::system_error(errno, std::generic_category(), "accept");
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stopping.load()) {
+			close(fd);
+			return;
+		}
+
+		// Reap connections that have been closed in the meantime.
+		for (auto it = connections.begin(); it != connections.end();) {
+			if (it->finished) {
+				it->thread.join();
+				it = connections.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		Connection &connection = connections.emplace_back();
+		connection.fd = fd;
+		connection.thread = std::thread(&Server::serve, this,
+		                                std::ref(connection));
+	}
+}
+
+void Server::stop()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	stopping.store(true);
+	// Wakes up accept and reads of connections.
+	shutdown(listenFd, SHUT_RDWR);
+	for (Connection &connection : connections)
+		if (!connection.finished)
+			shutdown(connection.fd, SHUT_RDWR);
+}
+
+void Server::serve(Connection &connection)
+{
+	int fd = connection.fd;
+	std::string buffer, line;
+	while (!stopping.load() && readLine(fd, buffer, line)) {
+		Job job;
+		job.fd = fd;
+
+		std::istringstream request(line);
+		std::string command, rest;
+		long timeout = -1;
+		job.radix = 0;
+		request >> command >> job.radix >> timeout >> job.equation;
+		if (command.empty())
+			continue;
+		if (command != "SOLVE") {
+			writeLine(fd, "ERROR Unknown command\n");
+			continue;
+		}
+		if (!request || (request >> rest) || job.radix < 2 || timeout < 0) {
+			writeLine(fd, "ERROR Expected SOLVE <radix> <timeout> "
+			              "<equation>\n");
+			continue;
+		}
+		job.deadline = timeout ? Clock::now()
+			+ std::chrono::milliseconds(timeout) : Clock::time_point::max();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(&job);
+		}
+		queued.notify_one();
+
+		// Only the worker writes to the connection until the job is done.
+		std::unique_lock<std::mutex> lock(job.mutex);
+		while (!job.done) {
+			if (job.finished.wait_for(lock, hangupInterval)
+					== std::cv_status::no_timeout)
+				continue;
+			if (!job.cancelled && (stopping.load() || hungUp(fd))) {
+				job.cancelled = true;
+				if (job.task)
+					job.task->cancel();
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	close(fd);
+	connection.finished = true;
+}
+
+void Server::work()
+{
+	Worker worker(options);
+	for (;;) {
+		Job *job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queued.wait(lock, [this] { return draining || !queue.empty(); });
+			if (queue.empty())
+				return;
+			job = queue.front();
+			queue.pop_front();
+		}
+
+		worker.run(*job);
+
+		// The connection destroys the job once it sees it done.
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		job->finished.notify_one();
+	}
+}
+
+// END Implementation of Server
+
+} // namespace puzzle
@@ -0,0 +1,96 @@
+#ifndef PUZZLE_SERVER
+#define PUZZLE_SERVER
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace puzzle {
+
+class ResultCache;
+
+struct ServerOptions {
+	/// Number of worker threads, or one per core if 0.
+	unsigned numWorkers = 0;
+	/// Shared by all workers, if not null. Has to outlive the server.
+	ResultCache *cache = nullptr;
+	/// Whether to generate native code for puzzles.
+	bool native = false;
+	/// Number of prepared puzzles each worker keeps for reuse.
+	size_t maxPrepared = 64;
+};
+
+/**
+ * Solver daemon listening on a UNIX domain socket.
+ *
+ * Clients send one request per line:
+ *
+ *     SOLVE <radix> <timeout in ms, 0 for none> <equation>
+ *
+ * and receive, for each request in order,
+ *
+ *     LETTERS <letter>...
+ *     SOLUTION <digit>...        (once per solution, as soon as it is found)
+ *     DONE <count> completed|cancelled|timeout
+ *
+ * A request that fails is answered with, or ends with, "ERROR <message>"
+ * instead. The timeout counts from the arrival of the request, so it includes
+ * time spent waiting for a worker.
+ *
+ * Requests of all connections are queued for a shared pool of workers. Each
+ * worker keeps parsed puzzles and their evaluators (including compiled native
+ * code) for reuse by later requests for the same puzzle. A solve is cancelled
+ * when its client hangs up.
+ */
+class Server {
+public:
+	/// Listen on @p socketPath. A socket file that no server listens on
+	/// anymore is replaced. Throws std::system_error if anything else is
+	/// there, or if another server is still listening on it.
+	Server(const char *socketPath, ServerOptions options = {});
+	Server(const Server &) = delete;
+	Server &operator=(const Server &) = delete;
+	~Server();
+
+	/// Accept connections until stop() is called. Has to return before the
+	/// server is destroyed.
+	void run();
+	/// Stop accepting connections and cancel running solves. Thread-safe.
+	void stop();
+
+private:
+	struct Job;
+	class Worker;
+
+	struct Connection {
+		int fd;
+		std::thread thread;
+		bool finished = false;
+	};
+
+	void serve(Connection &connection);
+	void work();
+
+	std::string path;
+	ServerOptions options;
+	int listenFd;
+	std::atomic<bool> stopping{false};
+
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::deque<Job *> queue;
+	/// Set once all connections are closed, to let workers exit.
+	bool draining = false;
+	std::vector<std::thread> workers;
+	std::list<Connection> connections;
+};
+
+} // namespace puzzle
+
+#endif
@@ -0,0 +1,83 @@
+#include "sweep.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+namespace puzzle {
+
+RadixSweep::RadixSweep(const char *puzzle, int from, int to)
+	: from(from), to(to), base(puzzle, to)
+{
+	if (from < 2 || from > to)
+		throw std::invalid_argument("Invalid radix range");
+	try {
+		form = std::make_unique<LinearForm>(base);
+	} catch (const Unsupported &) {}
+}
+
+SweepResult RadixSweep::solve(int radix) const
+{
+	SweepResult result{radix, SweepResult::Status::Solved, 0, {}, 0};
+	if (base.getNumLetters() > radix) {
+		result.status = SweepResult::Status::TooManyLetters;
+		return result;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	// Literals are smaller in smaller radices, so this can't overflow.
+	auto puzzle = std::make_unique<Puzzle>(base, radix);
+
+	std::unique_ptr<Evaluator> eval;
+	try {
+		if (!form)
+			throw Unsupported{};
+		eval = std::make_unique<LinearEvaluator>(*puzzle, *form);
+	} catch (const Unsupported &) {
+		eval = std::make_unique<GenericEvaluator>(*puzzle);
+	}
+
+	try {
+		PuzzleSolver solver(*puzzle, *eval);
+		result.numSolutions = solver.solve([&](const int *assignment) {
+			if (result.solution.empty())
+				result.solution.assign(assignment,
+				                       assignment + puzzle->getNumLetters());
+			return true;
+		});
+	} catch (const std::overflow_error &) {
+		result.status = SweepResult::Status::Overflow;
+	}
+
+	std::chrono::duration<double> time
+		= std::chrono::steady_clock::now() - start;
+	result.seconds = time.count();
+	return result;
+}
+
+std::vector<SweepResult> RadixSweep::run(unsigned numThreads) const
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<SweepResult> results(to - from + 1);
+	// Larger radices take longest, so start with them to balance the load.
+	std::atomic<int> next{to};
+	auto work = [&] {
+		int radix;
+		while ((radix = next.fetch_sub(1, std::memory_order_relaxed)) >= from)
+			results[radix - from] = solve(radix);
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
+		threads.emplace_back(work);
+	work();
+	for (std::thread &thread : threads)
+		thread.join();
+
+	return results;
+}
+
+} // namespace puzzle
@@ -0,0 +1,59 @@
+#ifndef PUZZLE_SWEEP
+#define PUZZLE_SWEEP
+
+#include "puzzle.hpp"
+#include <memory>
+#include <vector>
+
+namespace puzzle {
+
+struct SweepResult {
+	enum class Status {
+		Solved,
+		/// Skipped, as there are more letters than digits.
+		TooManyLetters,
+		/// Evaluation overflowed even 128 bits.
+		Overflow,
+	};
+
+	int radix;
+	Status status;
+	int numSolutions;
+	/// The first solution found, if any.
+	std::vector<int> solution;
+	/// Wall-clock time for setting up and solving, in seconds.
+	double seconds;
+};
+
+/**
+ * Solves a puzzle for a range of radices.
+ *
+ * The puzzle is parsed once, and the syntax trees are shared by all radices
+ * unless literals have to be re-valued. Linear puzzles are brought into a
+ * LinearForm once, which is then evaluated per radix. Radices with fewer
+ * digits than letters are skipped without solving.
+ */
+class RadixSweep {
+public:
+	/// Sweep radices @p from to @p to, inclusive.
+	RadixSweep(const char *puzzle, int from, int to);
+
+	/// The puzzle in the largest radix, for its letters.
+	const Puzzle &getPuzzle() const { return base; }
+
+	/// Results ordered by radix. Radices are solved in parallel with the
+	/// given number of threads, or one per core if 0.
+	std::vector<SweepResult> run(unsigned numThreads = 0) const;
+
+private:
+	SweepResult solve(int radix) const;
+
+	int from, to;
+	Puzzle base;
+	/// Shared by all radices, if the puzzle is linear.
+	std::unique_ptr<LinearForm> form;
+};
+
+} // namespace puzzle
+
+#endif
@@ -1,6 +1,28 @@
+#include "analysis.hpp"
+#include "async.hpp"
+#include "cache.hpp"
+#include "compact.hpp"
+#include "expr.hpp"
+#include "generate.hpp"
+#include "native.hpp"
 #include "puzzle.hpp"
+#include "server.hpp"
+#include "sweep.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 #include <gtest/gtest.h>
 
 using namespace puzzle;
@@ -15,6 +37,11 @@ static std::unique_ptr<Evaluator> makeLinear(const Puzzle &puzzle)
 	return std::make_unique<LinearEvaluator>(puzzle);
 }
 
+static std::unique_ptr<Evaluator> makeNative(const Puzzle &puzzle)
+{
+	return std::make_unique<NativeEvaluator>(puzzle);
+}
+
 class PuzzleTest :
 	public testing::TestWithParam<std::tuple<const char*,
 		std::unique_ptr<Evaluator> (*)(const Puzzle &puzzle)>> {};
@@ -87,4 +114,699 @@ static constexpr const char *special[] = {
 INSTANTIATE_TEST_SUITE_P(PureTests, PuzzleTest,
 	testing::Combine(
 		testing::ValuesIn(puzzles),
-		testing::Values(makeGeneric, makeLinear)));
+		testing::Values(makeGeneric, makeLinear, makeNative)));
+
+TEST(NativeEvaluatorTest, RefusesSharedCacheDirectories)
+{
+	std::string dir = testing::TempDir() + "puzzle_native_test";
+	mkdir(dir.c_str(), 0700);
+	chmod(dir.c_str(), 0777);
+	Puzzle puzzle("SEND+MORE=MONEY", 10);
+	EXPECT_THROW(NativeEvaluator(puzzle, dir), Unsupported);
+	rmdir(dir.c_str());
+}
+
+TEST(ExprBuilderTest, SharesIdenticalSubtrees)
+{
+	Arena arena;
+	ExprBuilder builder(arena);
+	const Letter letters[] = {0, 1, 2};
+	const Expr *word = builder.word(letters, 3);
+	EXPECT_EQ(word, builder.word(letters, 3));
+	EXPECT_NE(word, builder.word(letters, 2));
+	const Expr *sum = builder.binary(BinaryExpr::Op::Add, word, builder.number(3));
+	EXPECT_EQ(sum, builder.binary(BinaryExpr::Op::Add, word, builder.number(3)));
+}
+
+TEST(ExprBuilderTest, FoldsConstants)
+{
+	Arena arena;
+	ExprBuilder builder(arena);
+	using enum BinaryExpr::Op;
+	const Expr *expr = builder.binary(Mul,
+		builder.binary(Add, builder.number(2), builder.number(3)),
+		builder.number(4));
+	ASSERT_TRUE(NumberExpr::classof(expr));
+	EXPECT_EQ(cast<NumberExpr>(expr)->getValue(), 20);
+
+	// Inexact division isn't folded.
+	EXPECT_TRUE(BinaryExpr::classof(
+		builder.binary(Div, builder.number(1), builder.number(3))));
+}
+
+TEST(ExprBuilderTest, RewritesSumOfEqualTerms)
+{
+	Arena arena;
+	ExprBuilder builder(arena);
+	using enum BinaryExpr::Op;
+	const Letter letters[] = {0, 1};
+	const Expr *word = builder.word(letters, 2);
+	const Expr *expr = builder.binary(Add,
+		builder.binary(Add, word, word), word);
+	ASSERT_TRUE(BinaryExpr::classof(expr));
+	const BinaryExpr *binExpr = cast<BinaryExpr>(expr);
+	EXPECT_EQ(binExpr->getOp(), Mul);
+	ASSERT_TRUE(NumberExpr::classof(binExpr->getLeft()));
+	EXPECT_EQ(cast<NumberExpr>(binExpr->getLeft())->getValue(), 3);
+	EXPECT_EQ(binExpr->getRight(), word);
+
+	const Expr *zero = builder.binary(Sub, word, word);
+	ASSERT_TRUE(NumberExpr::classof(zero));
+	EXPECT_EQ(cast<NumberExpr>(zero)->getValue(), 0);
+}
+
+TEST(CanonicalFormTest, IgnoresNamingAndOperandOrder)
+{
+	Puzzle puzzle("SEND+MORE=MONEY", 10);
+	Puzzle swapped("MONEY=MORE+SEND", 10);
+	Puzzle renamed("TFOE+NPSF=NPOFZ", 10);
+	EXPECT_EQ(CanonicalForm(puzzle).getKey(), CanonicalForm(swapped).getKey());
+	EXPECT_EQ(CanonicalForm(puzzle).getKey(), CanonicalForm(renamed).getKey());
+	EXPECT_NE(CanonicalForm(puzzle).getKey(),
+	          CanonicalForm(Puzzle("SEND+MORE=MONEY", 11)).getKey());
+	EXPECT_NE(CanonicalForm(puzzle).getKey(),
+	          CanonicalForm(Puzzle("SEND-MORE=MONEY", 10)).getKey());
+}
+
+/// Evaluator that rejects everything, to see whether a result was cached.
+class RejectingEvaluator : public Evaluator {
+public:
+	using Evaluator::Evaluator;
+	bool operator()(const int *) const override { return false; }
+};
+
+TEST(ResultCacheTest, MapsCachedSolutionsToLetters)
+{
+	std::string path = testing::TempDir() + "puzzle_cache_test";
+	std::remove(path.c_str());
+
+	{
+		ResultCache cache(path.c_str());
+		Puzzle puzzle("SEND+MORE=MONEY", 10);
+		LinearEvaluator eval(puzzle);
+		PuzzleSolver solver(puzzle, eval, &cache);
+		EXPECT_EQ(solver.solve([](const int *) { return true; }), 1);
+	}
+
+	ResultCache cache(path.c_str());
+	Puzzle renamed("NPSF+TFOE=NPOFZ", 10);
+	RejectingEvaluator reject(renamed);
+	LinearEvaluator eval(renamed);
+	PuzzleSolver solver(renamed, reject, &cache);
+	int numSolutions = solver.solve([&](const int *assignment) {
+		EXPECT_TRUE(eval(assignment));
+		return true;
+	});
+	EXPECT_EQ(numSolutions, 1);
+	std::remove(path.c_str());
+}
+
+TEST(ResultCacheTest, RejectsForeignAndDamagedFiles)
+{
+	std::string path = testing::TempDir() + "puzzle_cache_test";
+	std::remove(path.c_str());
+	{
+		std::ofstream file(path);
+		file << "SEND+MORE=MONEY\n";
+	}
+	EXPECT_THROW(ResultCache cache(path.c_str()), std::runtime_error);
+
+	// A record whose lengths wrap around if multiplied naively.
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file << "PZCACHE1";
+		const uint32_t header[] = {0xffffffff, 0x40000000, 0x40000000};
+		file.write(reinterpret_cast<const char *>(header), sizeof(header));
+		file << "key";
+	}
+	{
+		ResultCache cache(path.c_str());
+		Puzzle puzzle("SEND+MORE=MONEY", 10);
+		EXPECT_FALSE(cache.lookup(puzzle));
+		cache.store(puzzle, {});
+		EXPECT_FALSE(cache.lookup(puzzle));
+	}
+	std::remove(path.c_str());
+}
+
+TEST(AsyncSolveTest, Completes)
+{
+	Puzzle puzzle("SEND+MORE=MONEY", 10);
+	LinearEvaluator eval(puzzle);
+	AsyncSolve solve(puzzle, eval);
+	SolveResult result = solve.wait();
+	EXPECT_EQ(result.status, SolveResult::Status::Completed);
+	EXPECT_EQ(result.solutions.size(), 1u);
+	// The analysis fixes M and O, so the search visits far fewer nodes than
+	// there are maps.
+	EXPECT_GT(result.explored, 0u);
+	EXPECT_LT(result.explored, 1814400u);
+	EXPECT_DOUBLE_EQ(solve.getProgress(), 1.0);
+}
+
+TEST(AsyncSolveTest, InfeasibleCompletes)
+{
+	// Odd and even, which the analysis finds without searching.
+	Puzzle puzzle("ABCDEF+ABCDEF=GHIJKL+GHIJKL+1", 20);
+	LinearEvaluator eval(puzzle);
+	AsyncSolve solve(puzzle, eval);
+	SolveResult result = solve.wait();
+	EXPECT_EQ(result.status, SolveResult::Status::Completed);
+	EXPECT_TRUE(result.solutions.empty());
+	EXPECT_EQ(result.explored, 0u);
+	EXPECT_DOUBLE_EQ(solve.getProgress(), 1.0);
+}
+
+TEST(AsyncSolveTest, ReportsOverflow)
+{
+	// Too large even for 128 bits, which the evaluator only finds out while
+	// evaluating.
+	Puzzle puzzle("AB*AB*AB*AB*AB*AB*AB*AB*AB*AB*AB*AB*AB*AB*AB=BA*AB", 36);
+	GenericEvaluator eval(puzzle);
+	ASSERT_EQ(eval.getWidth(), Width::Checked);
+	AsyncSolve solve(puzzle, eval);
+	SolveResult result = solve.wait();
+	EXPECT_TRUE(solve.isDone());
+	EXPECT_EQ(result.status, SolveResult::Status::Failed);
+	EXPECT_FALSE(result.error.empty());
+}
+
+TEST(AsyncSolveTest, Cancel)
+{
+	// Far too many maps to finish in the test.
+	Puzzle puzzle("ABCDEF+GHIJKL=MNOPQR", 20);
+	LinearEvaluator eval(puzzle);
+	AsyncSolve solve(puzzle, eval);
+	solve.cancel();
+	SolveResult result = solve.wait();
+	EXPECT_EQ(result.status, SolveResult::Status::Cancelled);
+	EXPECT_LT(solve.getProgress(), 1.0);
+}
+
+TEST(AsyncSolveTest, TimeLimit)
+{
+	Puzzle puzzle("ABCDEF+GHIJKL=MNOPQR", 20);
+	LinearEvaluator eval(puzzle);
+	SolveOptions options;
+	options.timeLimit = std::chrono::milliseconds(20);
+	AsyncSolve solve(puzzle, eval, std::move(options));
+	SolveResult result = solve.wait();
+	EXPECT_EQ(result.status, SolveResult::Status::TimedOut);
+	EXPECT_GT(result.explored, 0u);
+}
+
+TEST(AsyncSolveTest, TimeLimitStopsSearch)
+{
+	// Systems are searched, and these equations leave every map valid.
+	Puzzle puzzle("ABCDEFGHIJ+KLMNOPQRST=KLMNOPQRST+ABCDEFGHIJ,A+B=B+A", 20);
+	LinearEvaluator eval(puzzle);
+	SolveOptions options;
+	options.timeLimit = std::chrono::milliseconds(20);
+	AsyncSolve solve(puzzle, eval, std::move(options));
+	SolveResult result = solve.wait();
+	EXPECT_EQ(result.status, SolveResult::Status::TimedOut);
+	EXPECT_GT(result.explored, 0u);
+	EXPECT_GT(solve.getProgress(), 0.0);
+	EXPECT_LT(solve.getProgress(), 1.0);
+}
+
+TEST(GeneratorTest, FindsUniquePuzzles)
+{
+	std::istringstream dictionary("send more money\nMoney 2dollars eel");
+	Generator generator(readDictionary(dictionary), "word+word=word", 10);
+	std::vector<std::string> found;
+	GeneratorStats stats = generator.run(
+		[&found](const std::string &puzzle) { found.push_back(puzzle); }, 2);
+	std::sort(found.begin(), found.end());
+	EXPECT_EQ(found, (std::vector<std::string>{
+		"EEL+EEL=MORE", "MORE+SEND=MONEY"}));
+	// 10 ordered pairs of summands from 4 words, with 4 results each. The
+	// result has to be as long as the longest summand, or one longer.
+	EXPECT_EQ(stats.candidates, 40u);
+	EXPECT_EQ(stats.solved, 22u);
+	EXPECT_EQ(stats.failed, 0u);
+	EXPECT_EQ(stats.unique, 2u);
+}
+
+TEST(GeneratorTest, SubstitutesWordsIntoPattern)
+{
+	// Fixed letters and numbers in the pattern, solved like parsed puzzles.
+	std::vector<std::string> words = {"AB", "BA", "CAB", "EEL", "GO", "MORE",
+	                                  "OUT", "SEND", "TO"};
+	std::istringstream dictionary("ab ba cab eel go more out send to");
+	const char *pattern = "word+MO=word-10";
+	Generator generator(readDictionary(dictionary), pattern, 10);
+	std::vector<std::string> found;
+	generator.run(
+		[&found](const std::string &puzzle) { found.push_back(puzzle); }, 2);
+
+	std::vector<std::string> expected;
+	for (const std::string &first : words)
+		for (const std::string &second : words) {
+			std::string text = first + "+MO=" + second + "-10";
+			Puzzle puzzle(text.c_str(), 10);
+			if (puzzle.getNumLetters() > 10)
+				continue;
+			LinearEvaluator eval(puzzle);
+			int numSolutions = 0;
+			PuzzleSolver(puzzle, eval).solve(
+				[&](const int *) { return ++numSolutions < 2; });
+			if (numSolutions == 1)
+				expected.push_back(text);
+		}
+	std::sort(found.begin(), found.end());
+	std::sort(expected.begin(), expected.end());
+	EXPECT_FALSE(expected.empty());
+	EXPECT_EQ(found, expected);
+}
+
+TEST(GeneratorTest, RejectsCandidatesThatCantBeParsed)
+{
+	// The slot is glued to Z, so the first word makes a word too long.
+	std::istringstream dictionary("abcdefghijklmnop q");
+	Generator generator(readDictionary(dictionary), "Zword=word", 20);
+	std::vector<std::string> found;
+	GeneratorStats stats;
+	EXPECT_NO_THROW(stats = generator.run(
+		[&found](const std::string &puzzle) { found.push_back(puzzle); }, 2));
+	EXPECT_TRUE(found.empty());
+	// ZABCDEFGHIJKLMNOP is too long, with either word on the right.
+	EXPECT_EQ(stats.candidates, 4u);
+	EXPECT_EQ(stats.failed, 2u);
+	EXPECT_EQ(stats.solved, 2u);
+}
+
+TEST(WidthTest, SelectsNarrowestSafeWidth)
+{
+	Puzzle small("SEND+MORE=MONEY", 10);
+	EXPECT_EQ(LinearEvaluator(small).getWidth(), Width::Int32);
+	EXPECT_EQ(GenericEvaluator(small).getWidth(), Width::Int64);
+
+	Puzzle large("ABCDEFGHIJKLMNOP=QRSTUVWXYZ", 36);
+	EXPECT_EQ(LinearEvaluator(large).getWidth(), Width::Int128);
+	EXPECT_EQ(GenericEvaluator(large).getWidth(), Width::Int128);
+
+	Puzzle square("ABCDEFGHIJKLMNOP*ABCDEFGHIJKLMNOP=QRSTUVWXYZ", 36);
+	EXPECT_EQ(GenericEvaluator(square).getWidth(), Width::Checked);
+}
+
+TEST(WidthTest, EvaluatesLongWordsExactly)
+{
+	Puzzle puzzle("ABCDEFGHIJKLMNOP+B=ABCDEFGHIJKLMNOQ", 36);
+	int assignment[17];
+	for (int i = 0; i < 16; ++i)
+		assignment[i] = i + 1;
+	assignment[16] = assignment[15] + assignment[1];
+
+	LinearEvaluator linear(puzzle);
+	GenericEvaluator generic(puzzle);
+	EXPECT_TRUE(linear(assignment));
+	EXPECT_TRUE(generic(assignment));
+	++assignment[16];
+	EXPECT_FALSE(linear(assignment));
+	EXPECT_FALSE(generic(assignment));
+}
+
+TEST(WidthTest, ReportsOverflow)
+{
+	Puzzle puzzle("ABCDEFGHIJKLMNOP*ABCDEFGHIJKLMNOP=BACDEFGHIJKLMNOP", 36);
+	int assignment[16];
+	for (int i = 0; i < 16; ++i)
+		assignment[i] = i + 1;
+	GenericEvaluator generic(puzzle);
+	EXPECT_THROW(generic(assignment), std::overflow_error);
+}
+
+TEST(KernelTest, MatchesGenericEnumeration)
+{
+	// Specialized radix 10 and 16, and runtime radix 11.
+	std::pair<const char *, int> puzzles[] = {
+		{"SEND+MORE=MONEY", 10}, {"SEND+MORE=MONEY", 11}, {"ONE+ONE=TWO", 16},
+	};
+	for (auto [text, radix] : puzzles) {
+		Puzzle puzzle(text, radix);
+		LinearEvaluator eval(puzzle);
+		int numLetters = puzzle.getNumLetters();
+		std::vector<std::vector<int>> kernel, generic;
+		eval.enumerate([&](const int *assignment) {
+			kernel.emplace_back(assignment, assignment + numLetters);
+			return true;
+		});
+		eval.Evaluator::enumerate([&](const int *assignment) {
+			generic.emplace_back(assignment, assignment + numLetters);
+			return true;
+		});
+		EXPECT_FALSE(kernel.empty()) << text << " in radix " << radix;
+		EXPECT_EQ(kernel, generic) << text << " in radix " << radix;
+	}
+}
+
+static int bruteForce(const Puzzle &puzzle, const Evaluator &eval)
+{
+	int numSolutions = 0;
+	MapGen mapGen(puzzle.getNumLetters(), puzzle.getRadix());
+	do
+		numSolutions += eval(*mapGen);
+	while (mapGen.nextMap());
+	return numSolutions;
+}
+
+TEST(SystemTest, SolvesJointly)
+{
+	const char *systems[] = {
+		"SEND+MORE=MONEY,RE+SE=MRO",
+		"ABC+DEF=GHI,ADG+BEH=CFI",
+		"AB*C=DE,A+B+C=F+G",
+	};
+	for (const char *text : systems) {
+		Puzzle puzzle(text, 10);
+		GenericEvaluator generic(puzzle);
+		int expected = bruteForce(puzzle, generic);
+		PuzzleSolver genericSolver(puzzle, generic);
+		EXPECT_EQ(genericSolver.solve([](const int *) { return true; }),
+		          expected) << text;
+
+		try {
+			LinearEvaluator linear(puzzle);
+			PuzzleSolver linearSolver(puzzle, linear);
+			EXPECT_EQ(linearSolver.solve([&](const int *assignment) {
+				EXPECT_TRUE(generic(assignment)) << text;
+				return true;
+			}), expected) << text;
+		} catch (const Unsupported &) {}
+	}
+}
+
+TEST(SystemTest, DerivesRowsWithFewerLetters)
+{
+	// Subtracting the equations leaves C=D.
+	Puzzle puzzle("A+B+C=EF,A+B+D=EF", 10);
+	LinearEvaluator linear(puzzle);
+	ASSERT_EQ(linear.getNumRows(), 3);
+	EXPECT_EQ(linear.getConstraintLetters(0).count(), 2u);
+}
+
+TEST(SystemTest, SkipsDerivedRowsThatMightOverflow)
+{
+	// Eliminating some letters gives partial sums beyond 128 bits, which
+	// used to make the whole system unsupported.
+	Puzzle puzzle("GHFDFBEHEDCCCGCG+DEA=ECCECGDFAHAEDEHD,"
+	              "AEAGDCEDCECEAAFH=BAGHCFBCAAFDEBF+GE", 18);
+	EXPECT_NO_THROW(LinearEvaluator linear(puzzle));
+}
+
+TEST(SystemTest, ReportsEmptyEquations)
+{
+	try {
+		Puzzle puzzle("A+A=B,", 10);
+		FAIL() << "Parsed an empty equation";
+	} catch (const std::invalid_argument &error) {
+		EXPECT_STREQ(error.what(), "Equation 2 is empty");
+	}
+}
+
+/// Client for the server's line protocol.
+class Client {
+public:
+	explicit Client(const std::string &path)
+	{
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		std::snprintf(address.sun_path, sizeof(address.sun_path), "%s",
+		              path.c_str());
+		EXPECT_EQ(connect(fd, reinterpret_cast<const sockaddr *>(&address),
+		                  sizeof(address)), 0);
+	}
+	~Client() { close(fd); }
+
+	void send(const std::string &text)
+	{
+		ASSERT_EQ(write(fd, text.data(), text.size()), ssize_t(text.size()));
+	}
+
+	/// Lines of the next response, up to the DONE or ERROR line.
+	std::vector<std::string> receive()
+	{
+		std::vector<std::string> lines;
+		for (;;) {
+			size_t newline;
+			while ((newline = buffer.find('\n')) == std::string::npos) {
+				char chunk[256];
+				ssize_t received = read(fd, chunk, sizeof(chunk));
+				if (received <= 0)
+					return lines;
+				buffer.append(chunk, received);
+			}
+			lines.push_back(buffer.substr(0, newline));
+			buffer.erase(0, newline + 1);
+			if (lines.back().starts_with("DONE")
+					|| lines.back().starts_with("ERROR"))
+				return lines;
+		}
+	}
+
+private:
+	int fd;
+	std::string buffer;
+};
+
+TEST(ServerTest, AnswersConcurrentClients)
+{
+	std::string path = testing::TempDir() + "puzzle_server_test";
+	ServerOptions options;
+	options.numWorkers = 2;
+	Server server(path.c_str(), options);
+	std::thread thread([&] { server.run(); });
+
+	const std::vector<std::string> expected = {
+		"LETTERS D E M N O R S Y",
+		"SOLUTION 7 5 1 6 0 8 9 2",
+		"DONE 1 completed",
+	};
+	{
+		Client first(path), second(path);
+		// Pipelined requests are answered in order.
+		first.send("SOLVE 10 0 SEND+MORE=MONEY\nSOLVE 10 0 SEND+MORE=MONEY\n");
+		second.send("SOLVE 10 0 SEND+MORE=MONEY\nSOLVE 10 0 A+b=C\n"
+		            "SOLVE 2 0 ABC=D\nPING\n");
+		EXPECT_EQ(first.receive(), expected);
+		EXPECT_EQ(first.receive(), expected);
+		EXPECT_EQ(second.receive(), expected);
+		for (int i = 0; i < 3; ++i) {
+			std::vector<std::string> response = second.receive();
+			EXPECT_EQ(response.size(), 1u);
+			EXPECT_TRUE(!response.empty() && response[0].starts_with("ERROR "))
+				<< testing::PrintToString(response);
+		}
+	}
+
+	server.stop();
+	thread.join();
+}
+
+TEST(ServerTest, TimesOut)
+{
+	std::string path = testing::TempDir() + "puzzle_server_test";
+	Server server(path.c_str());
+	std::thread thread([&] { server.run(); });
+
+	{
+		Client client(path);
+		client.send("SOLVE 20 50 ABCDEF+GHIJKL=MNOPQR\n");
+		std::vector<std::string> response = client.receive();
+		EXPECT_TRUE(!response.empty() && response.back().ends_with(" timeout"))
+			<< testing::PrintToString(response);
+	}
+
+	server.stop();
+	thread.join();
+}
+
+TEST(ServerTest, OnlyReplacesStaleSockets)
+{
+	std::string path = testing::TempDir() + "puzzle_server_test";
+	unlink(path.c_str());
+	std::ofstream(path) << "data";
+	EXPECT_THROW(Server(path.c_str()), std::system_error);
+	EXPECT_EQ(unlink(path.c_str()), 0);
+
+	// A socket file nobody listens on anymore.
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	std::snprintf(address.sun_path, sizeof(address.sun_path), "%s",
+	              path.c_str());
+	ASSERT_EQ(bind(fd, reinterpret_cast<const sockaddr *>(&address),
+	               sizeof(address)), 0);
+	close(fd);
+
+	Server server(path.c_str());
+	EXPECT_THROW(Server(path.c_str()), std::system_error);
+	std::thread thread([&] { server.run(); });
+	{
+		Client client(path);
+		client.send("SOLVE 10 0 A+B=BA\n");
+		EXPECT_FALSE(client.receive().empty());
+	}
+	server.stop();
+	thread.join();
+}
+
+TEST(SweepTest, MatchesSeparateSolves)
+{
+	// Letters only, and with a number that depends on the radix.
+	for (const char *text : {"SEND+MORE=MONEY", "AB+9=BA", "AB*C=DE"}) {
+		RadixSweep sweep(text, 5, 11);
+		std::vector<SweepResult> results = sweep.run(2);
+		ASSERT_EQ(results.size(), 7u);
+		for (const SweepResult &result : results) {
+			Puzzle puzzle(text, result.radix);
+			if (puzzle.getNumLetters() > result.radix) {
+				EXPECT_EQ(result.status, SweepResult::Status::TooManyLetters);
+				continue;
+			}
+			GenericEvaluator eval(puzzle);
+			PuzzleSolver solver(puzzle, eval);
+			EXPECT_EQ(result.status, SweepResult::Status::Solved);
+			EXPECT_EQ(result.numSolutions,
+			          solver.solve([](const int *) { return true; }))
+				<< text << " in radix " << result.radix;
+			if (result.numSolutions) {
+				EXPECT_TRUE(eval(result.solution.data()));
+			}
+		}
+	}
+}
+
+TEST(SweepTest, SharesSyntaxTrees)
+{
+	Puzzle puzzle("SEND+MORE=MONEY", 10);
+	Puzzle other(puzzle, 16);
+	EXPECT_EQ(other.getRadix(), 16);
+	EXPECT_EQ(other.getRoots()[0], puzzle.getRoots()[0]);
+
+	LinearForm form(puzzle);
+	LinearEvaluator fromForm(other, form), direct(other);
+	for (int i = 0; i < other.getNumLetters(); ++i)
+		EXPECT_TRUE(fromForm.getCoeff(0, i) == direct.getCoeff(0, i));
+
+	Puzzle digits("AB+9=BA", 10);
+	EXPECT_EQ(Puzzle(digits, 16).getRoots()[0], digits.getRoots()[0]);
+}
+
+TEST(SweepTest, RevaluesLiterals)
+{
+	const char *text = "AB*10+C=CBA+100";
+	Puzzle base(text, 16);
+	LinearForm form(base);
+	for (int radix : {8, 10, 13}) {
+		Puzzle other(base, radix), parsed(text, radix);
+		EXPECT_NE(other.getRoots()[0], base.getRoots()[0]);
+
+		LinearEvaluator fromForm(other, form), direct(parsed);
+		ASSERT_EQ(fromForm.getNumRows(), direct.getNumRows());
+		EXPECT_TRUE(fromForm.getConstant(0) == direct.getConstant(0));
+		for (int i = 0; i < other.getNumLetters(); ++i)
+			EXPECT_TRUE(fromForm.getCoeff(0, i) == direct.getCoeff(0, i));
+
+		GenericEvaluator generic(other);
+		int a[] = {1, 2, 3};
+		EXPECT_EQ(generic(a), direct(a));
+	}
+}
+
+/// Whether @p node has the same structure as @p expr.
+static bool sameTree(Node node, const Expr *expr)
+{
+	if (node.getKind() != expr->getKind())
+		return false;
+	switch (expr->getKind()) {
+	case Expr::Kind::Number:
+		return cast<NumberNode>(node).getValue()
+			== cast<NumberExpr>(expr)->getValue();
+	case Expr::Kind::Word: {
+		std::span<const Letter> a = cast<WordNode>(node).getWord();
+		std::span<const Letter> b = cast<WordExpr>(expr)->getWord();
+		return std::equal(a.begin(), a.end(), b.begin(), b.end());
+	}
+	case Expr::Kind::Equality:
+		return sameTree(cast<EqualityNode>(node).getLeft(),
+		                cast<EqualityExpr>(expr)->getLeft())
+			&& sameTree(cast<EqualityNode>(node).getRight(),
+			            cast<EqualityExpr>(expr)->getRight());
+	case Expr::Kind::Binary:
+		return cast<BinaryNode>(node).getOp() == cast<BinaryExpr>(expr)->getOp()
+			&& sameTree(cast<BinaryNode>(node).getLeft(),
+			            cast<BinaryExpr>(expr)->getLeft())
+			&& sameTree(cast<BinaryNode>(node).getRight(),
+			            cast<BinaryExpr>(expr)->getRight());
+	}
+	return false;
+}
+
+TEST(CompactAstTest, CopiesSharedTrees)
+{
+	Puzzle puzzle("AB*CD+7=EF/AB,AB*CD=GH", 10);
+	CompactAst ast(puzzle.getRoots());
+	ASSERT_EQ(ast.getRoots().size(), 2u);
+	for (size_t i = 0; i < 2; ++i)
+		EXPECT_TRUE(sameTree(ast.getNode(ast.getRoots()[i]),
+		                     puzzle.getRoots()[i]));
+
+	// AB and AB*CD are stored once.
+	EXPECT_EQ(ast.getNumNodes(Expr::Kind::Number), 1u);
+	EXPECT_EQ(ast.getNumNodes(Expr::Kind::Word), 4u);
+	EXPECT_EQ(ast.getNumNodes(Expr::Kind::Equality), 2u);
+	EXPECT_EQ(ast.getNumNodes(Expr::Kind::Binary), 3u);
+	EXPECT_EQ(sizeof(CompactAst::Ref), 4u);
+}
+
+TEST(AnalysisTest, ReportsInfeasiblePuzzles)
+{
+	std::pair<const char *, const char *> puzzles[] = {
+		{"ABCDEFGHIJK=A", "letters"},
+		{"1+1=3", "false constant equation"},
+		{"A+B=B+A+1", "false constant equation"},
+		{"AA+BB=12", "divisor 11"},
+		{"D+E+EE=EED", "modulo 10"},
+		{"D+DD+DA=ABA", "modulo 9"},
+		{"ABCD+EFGH=IJ", "between"},
+		{"AC+D+E=CBD", "would have to be"},
+		{"AB*CD=ABCDE", "at most 9801"},
+	};
+	for (auto [text, reason] : puzzles) {
+		Puzzle puzzle(text, 10);
+		Analysis analysis(puzzle);
+		EXPECT_TRUE(analysis.isInfeasible()) << text;
+		EXPECT_NE(analysis.getReason().find(reason), std::string::npos)
+			<< text << ": " << analysis.getReason();
+	}
+}
+
+TEST(AnalysisTest, NarrowsDomains)
+{
+	Puzzle puzzle("SEND+MORE=MONEY", 10);
+	Analysis analysis(puzzle);
+	ASSERT_FALSE(analysis.isInfeasible());
+	// M is the carry, so M=1 and O=0.
+	EXPECT_EQ(analysis.getDomainSize(2), 1);
+	EXPECT_TRUE(analysis.allows(2, 1));
+	EXPECT_EQ(analysis.getDomainSize(4), 1);
+	EXPECT_TRUE(analysis.allows(4, 0));
+
+	// Solutions never use excluded digits.
+	for (const char *text : {"SEND+MORE=MONEY", "TO+GO=OUT", "AB+AB=CDE",
+	                         "ABC-DE=FG", "AB*C=DE,A+B+C=F+G"}) {
+		Puzzle puzzle(text, 10);
+		Analysis analysis(puzzle);
+		GenericEvaluator eval(puzzle);
+		MapGen mapGen(puzzle.getNumLetters(), puzzle.getRadix());
+		do {
+			if (!eval(*mapGen))
+				continue;
+			for (int i = 0; i < puzzle.getNumLetters(); ++i)
+				EXPECT_TRUE(analysis.allows(i, mapGen[i])) << text;
+		} while (mapGen.nextMap());
+	}
+}
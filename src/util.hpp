@@ -2,6 +2,7 @@
 #define PUZZLE_UTIL
 
 #include <cassert>
+#include <type_traits>
 
 #ifndef NDEBUG
 #define PUZZLE_UNREACHABLE assert(false)
@@ -25,4 +26,13 @@ const T* cast(const U* u)
 	return static_cast<const T*>(u);
 }
 
+/// Cast for handles passed by value, such as the nodes of CompactAst.
+template<typename T, typename U>
+	requires (!std::is_pointer_v<U>)
+T cast(const U &u)
+{
+	assert(T::classof(u));
+	return T(u);
+}
+
 #endif